@@ -47,6 +47,13 @@ struct _MetaCompositor
   void (*set_active_window) (MetaCompositor *compositor,
                              MetaScreen     *screen,
                              MetaWindow     *window);
+  void (*publish_stats) (MetaCompositor *compositor);
+  Pixmap (*get_window_thumbnail) (MetaCompositor *compositor,
+                                  MetaWindow     *window,
+                                  int             max_width,
+                                  int             max_height,
+                                  int            *width,
+                                  int            *height);
 };
 
 #endif
@@ -26,6 +26,10 @@
 
 #ifdef HAVE_COMPOSITE_EXTENSIONS
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
@@ -41,13 +45,21 @@
 #include "compositor-private.h"
 #include "compositor-xrender.h"
 #include "xprops.h"
+#include "shadow-kernels.h"
 #include <X11/Xatom.h>
+#include <X11/Xutil.h>
 #include <X11/extensions/shape.h>
 #include <X11/extensions/Xcomposite.h>
 #include <X11/extensions/Xdamage.h>
 #include <X11/extensions/Xfixes.h>
 #include <X11/extensions/Xrender.h>
 
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+
 #if COMPOSITE_MAJOR > 0 || COMPOSITE_MINOR >= 2
 #define HAVE_NAME_WINDOW_PIXMAP 1
 #endif
@@ -60,6 +72,50 @@
 
 #define USE_IDLE_REPAINT 1
 
+/* Default target frame rate of the repaint scheduler, overridable
+   with METACITY_COMPOSITOR_FPS (0 disables throttling) */
+#define DEFAULT_FRAME_RATE 60
+#define MAX_FRAME_RATE 240
+
+/* Damage caused by the user (focus changes, mapping, moving windows)
+   is painted no later than this many microseconds after it arrives,
+   even if the frame clock would otherwise wait longer */
+#define INPUT_FRAME_DEADLINE 4000
+
+/* Windows fade in when mapped, out when unmapped and between
+   opacities over this many milliseconds, unless
+   METACITY_COMPOSITOR_FADE_TIME says otherwise (0 turns fades off) */
+#define DEFAULT_FADE_TIME 120
+#define MAX_FADE_TIME 2000
+
+/* Thumbnails are filtered over at most this many source pixels
+   square, however far they are scaled down */
+#define THUMBNAIL_FILTER_MAX 8
+
+/* Paint times are counted in buckets of 1, 2, 4 ... 64 milliseconds,
+   the last bucket taking everything slower than that */
+#define PAINT_TIME_BUCKETS 8
+
+#ifdef HAVE_XSHM
+/* Images are uploaded through a small pool of shared memory segments.
+   Images bigger than the largest segment go over the connection. */
+#define SHM_SEGMENTS_MAX 4
+#define SHM_SEGMENT_MIN_SIZE (256 * 1024)
+#define SHM_SEGMENT_MAX_SIZE (16 * 1024 * 1024)
+
+typedef struct _MetaShmSegment
+{
+  /* First, so that the obdata of an image points at the segment */
+  XShmSegmentInfo info;
+  gsize size;
+
+  /* Held by an image, or read by the server until it has processed
+     request busy_serial */
+  gboolean in_use;
+  gulong busy_serial;
+} MetaShmSegment;
+#endif
+
 #ifdef HAVE_COMPOSITE_EXTENSIONS
 static inline gboolean
 composite_at_least_version (MetaDisplay *display,
@@ -124,27 +180,126 @@ typedef struct _MetaCompositorXRender
   Atom atom_net_wm_window_type_tooltip;
 
   Atom atom_metacity_window_have_shadow;
+  Atom atom_metacity_compositor_stats;
+  Atom atom_utf8_string;
 
 #ifdef USE_IDLE_REPAINT
   guint repaint_id;
+
+  /* Frame clock: repaints are throttled to one per frame_interval
+     (in microseconds, 0 means unthrottled).  Damage arriving while
+     a frame is scheduled is accumulated into that frame. */
+  gint64 frame_interval;
+  gint64 frame_deadline;
+  gint64 last_frame_time;
+
+  guint frames_painted;
+  guint frames_coalesced;
+  guint frames_dropped;
+#endif
+
+  /* Length of the fades in microseconds, 0 when they are off */
+  gint64 fade_time;
+
+  /* DamageNotify events received, and per-window damage regions
+     actually fetched from the server for them */
+  guint damage_events;
+  guint damage_regions;
+
+  /* Paint statistics, published on request in the
+     _METACITY_COMPOSITOR_STATS root window property */
+  guint paints;
+  guint paint_time_histogram[PAINT_TIME_BUCKETS];
+  gint64 paint_time_total;
+  gint64 paint_time_max;
+  guint64 damaged_pixels;
+  guint pictures_created;
+
+  /* Bytes copied from the root buffers to the screen */
+  guint64 bytes_composited;
+  guint64 bytes_composited_last;
+  guint64 bytes_composited_max;
+
+  /* Images uploaded through shared memory and over the connection */
+  guint uploads_shm;
+  guint uploads_socket;
+
+#ifdef HAVE_XSHM
+  gboolean have_shm;
+  GSList *shm_segments;
 #endif
+
+  /* Trace of the events the compositor acts on, written to the file
+     named by METACITY_COMPOSITOR_RECORD for compositor-replay */
+  FILE *trace;
+  gint64 trace_time;
+
   guint enabled : 1;
+  /* Damaged pixels are only counted under METACITY_DEBUG_COMPOSITOR
+     or once statistics have been asked for */
+  guint count_damaged_pixels : 1;
   guint show_redraw : 1;
   guint debug : 1;
 } MetaCompositorXRender;
 
-typedef struct _conv 
+typedef enum _MetaShadowSlice
 {
-  int size;
-  double *data;
-} conv;
+  SHADOW_SLICE_TOP_LEFT,
+  SHADOW_SLICE_TOP,
+  SHADOW_SLICE_TOP_RIGHT,
+  SHADOW_SLICE_LEFT,
+  SHADOW_SLICE_CENTRE,
+  SHADOW_SLICE_RIGHT,
+  SHADOW_SLICE_BOTTOM_LEFT,
+  SHADOW_SLICE_BOTTOM,
+  SHADOW_SLICE_BOTTOM_RIGHT,
+  LAST_SHADOW_SLICE
+} MetaShadowSlice;
 
 typedef struct _shadow 
 {
   conv *gaussian_map;
   guchar *shadow_corner;
   guchar *shadow_top;
+
+  /* Full opacity corner, edge and centre tiles; the edges and the
+     centre repeat so that any shadow can be composed from them */
+  Picture slices[LAST_SHADOW_SLICE];
 } shadow;
+
+/* Shadow pictures only depend on their type, size and opacity, so
+   windows with the same geometry share a single picture */
+typedef struct _MetaShadowCacheEntry
+{
+  MetaShadowType shadow_type;
+  int width;
+  int height;
+  guint opacity;
+
+  Picture picture;
+  int shadow_width;
+  int shadow_height;
+
+  guint ref_count;
+  GList *lru_link;
+
+  /* The picture is still being rendered by this job */
+  gboolean pending;
+  struct _MetaShadowJob *job;
+} MetaShadowCacheEntry;
+
+/* A shadow image rendered on a worker thread.  The worker only reads
+   the shadow tables and writes data, everything else belongs to the
+   main thread. */
+typedef struct _MetaShadowJob
+{
+  MetaShadowCacheEntry *entry; /* NULL once nobody wants the result */
+  shadow *shad;
+  double opacity;
+  int width;
+  int height;
+  guchar *data;
+} MetaShadowJob;
  
 typedef struct _MetaCompScreen 
 {
@@ -157,20 +312,82 @@ typedef struct _MetaCompScreen
   Window output;
 
   gboolean have_shadows;
+  gboolean nine_slice_shadows;
   shadow *shadows[LAST_SHADOW_TYPE];
 
+  GHashTable *shadow_cache;
+  GQueue *shadow_cache_lru;
+  gsize shadow_cache_size;
+  /* The part of it no window is using */
+  gsize shadow_cache_unused;
+  guint shadow_cache_hits;
+  guint shadow_cache_misses;
+
+  /* Shadow images rendered off the main thread; finished jobs are
+     handed back through shadow_jobs_done */
+  GThreadPool *shadow_pool;
+  GMutex shadow_jobs_lock;
+  GSList *shadow_jobs_done;
+  guint shadow_jobs_idle;
+  guint shadow_jobs_queued;
+  guint shadow_jobs_cancelled;
+
   Picture root_picture;
   Picture root_buffer;
+  /* As with buffer age in EGL: 0 when the contents of the root buffer
+     are undefined, otherwise how many frames ago they were presented.
+     There is only one root buffer, so once painted it stays at 1 and
+     only the damage since the last frame needs painting. */
+  int root_buffer_age;
+  int root_buffer_bytes_per_pixel;
   Picture black_picture;
   Picture trans_black_picture;
+  /* The background, made from root_tile_pixmap (None for the plain
+     default).  The version counts the times the picture was made. */
   Picture root_tile;
+  Pixmap root_tile_pixmap;
+  guint root_tile_version;
   XserverRegion all_damage;
 
+  /* Unmapped override redirect windows still holding their picture,
+     most recently unmapped first */
+  GQueue *kept_pictures;
+  gboolean picture_reuse;
+  guint pictures_reused;
+  guint pictures_evicted;
+
+  guint thumbnails_rendered;
+  guint thumbnails_reused;
+
+  /* Fullscreen window currently painting straight to the screen */
+  struct _MetaCompWindow *unredirected;
+  gboolean unredirect_enabled;
+
+  /* Windows whose opacity is being animated, stepped once a frame */
+  GSList *fading_windows;
+  guint fades_started;
+
   guint overlays;
   gboolean compositor_active;
   gboolean clip_changed;
 
+  /* Culling statistics for the last frame and in total: windows
+     hidden by opaque ones, and windows the damage doesn't touch */
+  guint windows_painted;
+  guint windows_culled;
+  guint windows_undamaged;
+  guint total_windows_painted;
+  guint total_windows_culled;
+  guint total_windows_undamaged;
+
+  /* Frames whose damage covered the whole screen, and the others */
+  guint frames_full;
+  guint frames_partial;
+
   GSList *dock_windows;
+
+  /* Windows with damage that has not been fetched from the server */
+  GSList *damaged_windows;
 } MetaCompScreen;
 
 typedef struct _MetaCompWindow 
@@ -201,6 +418,11 @@ typedef struct _MetaCompWindow
   Picture picture;
   Picture alpha_pict;
 
+  /* The picture is of the window itself rather than of a pixmap named
+     for it, so it stays valid across unmaps and resizes */
+  gboolean picture_on_window;
+  GList *kept_link;
+
   gboolean have_shadow;
   gboolean needs_shadow;
   MetaShadowType shadow_type;
@@ -210,6 +432,11 @@ typedef struct _MetaCompWindow
   XserverRegion extents;
 
   Picture shadow;
+  MetaShadowCacheEntry *shadow_entry;
+  gboolean shadow_sliced;
+
+  /* The previous shadow, drawn until shadow_entry is rendered */
+  MetaShadowCacheEntry *old_shadow_entry;
   int shadow_dx;
   int shadow_dy;
   int shadow_width;
@@ -217,10 +444,37 @@ typedef struct _MetaCompWindow
 
   guint opacity;
 
+  /* The opacity the window is painted at: opacity, except while
+     fading from fade_from.  A window fading out (fade_unmap) is
+     already unmapped and is freed once the fade is over. */
+  guint paint_opacity;
+  guint fade_from;
+  gint64 fade_start;
+  gboolean fading;
+  gboolean fade_unmap;
+  gboolean needs_fade_in;
+  /* Solid black at the fade's share of the shadow opacity, the source
+     for shadow images while fading */
+  Picture fade_pict;
+
+  /* Downscaled copy of the window for previews, rendered on request
+     and again only once the window has been damaged since */
+  Pixmap thumbnail_pixmap;
+  int thumbnail_width;
+  int thumbnail_height;
+  gboolean thumbnail_stale;
+
   XserverRegion border_clip;
 
   gboolean updates_frozen;
   gboolean update_pending;
+
+  /* Damage was reported and will be fetched on the next frame */
+  gboolean damage_pending;
+
+  /* Set while painting when the window is entirely hidden by opaque
+     windows above it */
+  gboolean culled;
 } MetaCompWindow;
 
 #define OPAQUE 0xffffffff
@@ -240,56 +494,24 @@ typedef struct _MetaCompWindow
 #define SHADOW_LARGE_OFFSET_Y -15
 
 #define SHADOW_OPACITY 0.66
- 
-#define TRANS_OPACITY 0.75
-
-#define DISPLAY_COMPOSITOR(display) ((MetaCompositorXRender *) meta_display_get_compositor (display))
 
-/* Gaussian stuff for creating the shadows */
-static double
-gaussian (double r,
-          double x,
-          double y)
-{
-  return ((1 / (sqrt (2 * G_PI * r))) *
-          exp ((- (x * x + y * y)) / (2 * r * r)));
-}
+/* Memory the shadow cache may hold on to for pictures no window is
+   currently using, in bytes of A8 pixmap data */
+#define SHADOW_CACHE_BUDGET (16 * 1024 * 1024)
 
-static conv *
-make_gaussian_map (double r)
-{
-  conv *c;
-  int size, centre;
-  int x, y;
-  double t, g;
+/* How many unmapped windows may keep their picture for when they are
+   mapped again.  The pictures hold no pixels while the window is
+   unmapped, this only bounds the server resources spent on them. */
+#define KEPT_PICTURES_MAX 32
 
-  size = ((int) ceil ((r * 3)) + 1) & ~1;
-  centre = size / 2;
-  c = g_malloc (sizeof (conv) + size * size * sizeof (double));
-  c->size = size;
-  c->data = (double *) (c + 1);
-  t = 0.0;
+/* Shadow images at least this many pixels in area are rendered on
+   worker threads instead of blocking the main loop */
+#define ASYNC_SHADOW_MIN_AREA (128 * 128)
+#define SHADOW_WORKER_THREADS 2
+ 
+#define TRANS_OPACITY 0.75
 
-  for (y = 0; y < size; y++) 
-    {
-      for (x = 0; x < size; x++) 
-        {
-          g = gaussian (r, (double) (x - centre), (double) (y - centre));
-          t += g;
-          c->data[y * size + x] = g;
-        }
-    }
-  
-  for (y = 0; y < size; y++) 
-    {
-      for (x = 0; x < size; x++) 
-        {
-          c->data[y * size + x] /= t;
-        }
-    }
-  
-  return c;
-}
+#define DISPLAY_COMPOSITOR(display) ((MetaCompositorXRender *) meta_display_get_compositor (display))
 
 static void
 dump_xserver_region (const char   *location, 
@@ -325,148 +547,279 @@ dump_xserver_region (const char   *location,
     fprintf (stderr, "%s (XSR): null\n", location);
 }
 
-/*
-* A picture will help
-*
-*      -center   0                width  width+center
-*  -center +-----+-------------------+-----+
-*          |     |                   |     |
-*          |     |                   |     |
-*        0 +-----+-------------------+-----+
-*          |     |                   |     |
-*          |     |                   |     |
-*          |     |                   |     |
-*   height +-----+-------------------+-----+
-*          |     |                   |     |
-* height+  |     |                   |     |
-*  center  +-----+-------------------+-----+
-*/
-static guchar
-sum_gaussian (conv          *map,
-              double         opacity,
-              int            x,
-              int            y,
-              int            width,
-              int            height)
-{
-  double *g_data, *g_line;
-  double v;
-  int fx, fy;
-  int fx_start, fx_end;
-  int fy_start, fy_end;
-  int g_size, centre;
-
-  g_line = map->data;
-  g_size = map->size;
-  centre = g_size / 2;
-  fx_start = centre - x;
-  if (fx_start < 0) 
-    fx_start = 0;
-
-  fx_end = width + centre - x;
-  if (fx_end > g_size) 
-    fx_end = g_size;
-
-  fy_start = centre - y;
-  if (fy_start < 0)
-    fy_start = 0;
-
-  fy_end = height + centre - y;
-  if (fy_end > g_size) 
-    fy_end = g_size;
-
-  g_line = g_line + fy_start * g_size + fx_start;
-
-  v = 0.0;
-  for (fy = fy_start; fy < fy_end; fy++) 
-    {
-      g_data = g_line;
-      g_line += g_size;
-      
-      for (fx = fx_start; fx < fx_end; fx++)
-        v += *g_data++;
+#ifdef HAVE_XSHM
+static MetaShmSegment *
+shm_segment_new (MetaDisplay *display,
+                 gsize        size)
+{
+  MetaCompositorXRender *xrc = DISPLAY_COMPOSITOR (display);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaShmSegment *seg;
+  int error;
+
+  seg = g_new0 (MetaShmSegment, 1);
+  seg->size = size;
+
+  seg->info.shmid = shmget (IPC_PRIVATE, size, IPC_CREAT | 0600);
+  if (seg->info.shmid < 0)
+    {
+      g_free (seg);
+      return NULL;
     }
-  
-  if (v > 1.0)
-    v = 1.0;
-  
-  return ((guchar) (v * opacity * 255.0));
+
+  seg->info.shmaddr = shmat (seg->info.shmid, NULL, 0);
+  if (seg->info.shmaddr == (char *) -1)
+    {
+      shmctl (seg->info.shmid, IPC_RMID, NULL);
+      g_free (seg);
+      return NULL;
+    }
+  seg->info.readOnly = True;
+
+  /* A remote server can't attach to our memory; find out now rather
+     than on the first upload.  This is the only round trip the pool
+     makes, once per segment. */
+  meta_error_trap_push_with_return (display);
+  XShmAttach (xdisplay, &seg->info);
+  XSync (xdisplay, False);
+  error = meta_error_trap_pop_with_return (display, TRUE);
+
+  /* Either way the segment goes away once both sides detach */
+  shmctl (seg->info.shmid, IPC_RMID, NULL);
+
+  if (error != Success)
+    {
+      meta_verbose ("Cannot attach shared memory segment, "
+                    "uploading images over the connection\n");
+      xrc->have_shm = FALSE;
+
+      shmdt (seg->info.shmaddr);
+      g_free (seg);
+      return NULL;
+    }
+
+  return seg;
 }
 
-/* precompute shadow corners and sides to save time for large windows */
 static void
-presum_gaussian (shadow *shad)
+shm_segment_free (MetaDisplay    *display,
+                  MetaShmSegment *seg)
 {
-  int centre;
-  int opacity, x, y;
-  int msize;
-  conv *map;
+  XShmDetach (meta_display_get_xdisplay (display), &seg->info);
+  shmdt (seg->info.shmaddr);
+  g_free (seg);
+}
+
+/* The server is done with a segment once it has processed the last
+   request reading from it; that is known without asking whenever
+   anything has come back from it since */
+static gboolean
+shm_segment_idle (Display        *xdisplay,
+                  MetaShmSegment *seg)
+{
+  return !seg->in_use &&
+    (glong) (LastKnownRequestProcessed (xdisplay) - seg->busy_serial) >= 0;
+}
 
-  map = shad->gaussian_map;
-  msize = map->size;
-  centre = map->size / 2;
+static MetaShmSegment *
+shm_segment_get (MetaDisplay *display,
+                 gsize        size)
+{
+  MetaCompositorXRender *xrc = DISPLAY_COMPOSITOR (display);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaShmSegment *smallest = NULL;
+  MetaShmSegment *seg;
+  GSList *l;
 
-  if (shad->shadow_corner)
-    g_free (shad->shadow_corner);
-  if (shad->shadow_top)
-    g_free (shad->shadow_top);
+  if (!xrc->have_shm || size > SHM_SEGMENT_MAX_SIZE)
+    return NULL;
 
-  shad->shadow_corner = (guchar *)(g_malloc ((msize + 1) * (msize + 1) * 26));
-  shad->shadow_top = (guchar *) (g_malloc ((msize + 1) * 26));
-  
-  for (x = 0; x <= msize; x++) 
+  for (l = xrc->shm_segments; l; l = l->next)
     {
-      
-      shad->shadow_top[25 * (msize + 1) + x] =
-        sum_gaussian (map, 1, x - centre, centre, msize * 2, msize * 2);
-      for (opacity = 0; opacity < 25; opacity++) 
-        {
-          shad->shadow_top[opacity * (msize + 1) + x] =
-            shad->shadow_top[25 * (msize + 1) + x] * opacity / 25;
-        }
-      
-      for (y = 0; y <= x; y++) 
-        {
-          shad->shadow_corner[25 * (msize + 1) * (msize + 1) 
-                              + y * (msize + 1) 
-                              + x]
-            = sum_gaussian (map, 1, x - centre, y - centre,
-                            msize * 2, msize * 2);
-          
-          shad->shadow_corner[25 * (msize + 1) * (msize + 1) 
-                              + x * (msize + 1) + y] =
-            shad->shadow_corner[25 * (msize + 1) * (msize + 1) 
-                                + y * (msize + 1) + x];
-          
-          for (opacity = 0; opacity < 25; opacity++) 
-            {
-              shad->shadow_corner[opacity * (msize + 1) * (msize + 1) 
-                                  + y * (msize + 1) + x]
-                = shad->shadow_corner[opacity * (msize + 1) * (msize + 1) 
-                                      + x * (msize + 1) + y]
-                = shad->shadow_corner[25 * (msize + 1) * (msize + 1) 
-                                      + y * (msize + 1) + x] * opacity / 25;
-            }
-        }
+      seg = l->data;
+
+      if (!shm_segment_idle (xdisplay, seg))
+        continue;
+
+      if (seg->size >= size)
+        return seg;
+
+      if (smallest == NULL || seg->size < smallest->size)
+        smallest = seg;
+    }
+
+  /* With the pool full, an idle segment too small for this image
+     makes way for a bigger one.  If they are all busy the image goes
+     over the connection instead of waiting for the server. */
+  if (g_slist_length (xrc->shm_segments) >= SHM_SEGMENTS_MAX)
+    {
+      if (smallest == NULL)
+        return NULL;
+
+      xrc->shm_segments = g_slist_remove (xrc->shm_segments, smallest);
+      shm_segment_free (display, smallest);
     }
+
+  seg = shm_segment_new (display, MAX (size, SHM_SEGMENT_MIN_SIZE));
+  if (seg)
+    xrc->shm_segments = g_slist_prepend (xrc->shm_segments, seg);
+
+  return seg;
+}
+#endif
+
+/* Creates an 8 bit deep image to upload, in shared memory if the
+   server supports it.  If data is given the image takes it over,
+   it must hold height rows of width bytes.  Rows of the image are
+   bytes_per_line apart, which need not be the width.  Free the image
+   with upload_image_destroy (). */
+static XImage *
+upload_image_new (MetaDisplay *display,
+                  MetaScreen  *screen,
+                  int          width,
+                  int          height,
+                  guchar      *data)
+{
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  Visual *visual = DefaultVisual (xdisplay,
+                                  meta_screen_get_screen_number (screen));
+  XImage *image;
+
+#ifdef HAVE_XSHM
+  {
+    /* Rows are padded to at most 32 bits */
+    MetaShmSegment *seg = shm_segment_get (display,
+                                           ((width + 3) & ~3) * height);
+
+    if (seg != NULL)
+      {
+        image = XShmCreateImage (xdisplay, visual, 8, ZPixmap, NULL,
+                                 &seg->info, width, height);
+        if (image != NULL &&
+            (gsize) image->bytes_per_line * height <= seg->size)
+          {
+            image->data = seg->info.shmaddr;
+            seg->in_use = TRUE;
+
+            if (data != NULL)
+              {
+                int y;
+
+                for (y = 0; y < height; y++)
+                  memcpy (image->data + y * image->bytes_per_line,
+                          data + y * width, width);
+                g_free (data);
+              }
+
+            return image;
+          }
+
+        if (image != NULL)
+          XDestroyImage (image);
+      }
+  }
+#endif
+
+  if (data == NULL)
+    data = g_malloc (width * height);
+
+  image = XCreateImage (xdisplay, visual, 8, ZPixmap, 0, (char *) data,
+                        width, height, 8, width);
+  if (image == NULL)
+    g_free (data);
+
+  return image;
 }
 
+/* Spreads out height rows of width bytes at the start of the image
+   data to where the image expects them */
 static void
-generate_shadows (MetaCompScreen *info)
+upload_image_restride (XImage *image,
+                       int     width,
+                       int     height)
 {
-  double radii[LAST_SHADOW_TYPE] = {SHADOW_SMALL_RADIUS,
-                                    SHADOW_MEDIUM_RADIUS,
-                                    SHADOW_LARGE_RADIUS};
-  int i;
+  int y;
 
-  for (i = 0; i < LAST_SHADOW_TYPE; i++) {
-    shadow *shad = g_new0 (shadow, 1);
+  if (image->bytes_per_line == width)
+    return;
 
-    shad->gaussian_map = make_gaussian_map (radii[i]);
-    presum_gaussian (shad);
+  for (y = height - 1; y > 0; y--)
+    memmove (image->data + y * image->bytes_per_line,
+             image->data + y * width, width);
+}
 
-    info->shadows[i] = shad;
-  }
+static void
+upload_image_put (MetaDisplay *display,
+                  Drawable     drawable,
+                  GC           gc,
+                  XImage      *image,
+                  int          src_x,
+                  int          src_y,
+                  int          width,
+                  int          height)
+{
+  MetaCompositorXRender *xrc = DISPLAY_COMPOSITOR (display);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+#ifdef HAVE_XSHM
+  if (image->obdata != NULL)
+    {
+      MetaShmSegment *seg = (MetaShmSegment *) image->obdata;
+
+      seg->busy_serial = NextRequest (xdisplay);
+      XShmPutImage (xdisplay, drawable, gc, image, src_x, src_y, 0, 0,
+                    width, height, False);
+      xrc->uploads_shm++;
+      return;
+    }
+#endif
+
+  XPutImage (xdisplay, drawable, gc, image, src_x, src_y, 0, 0,
+             width, height);
+  xrc->uploads_socket++;
+}
+
+static void
+upload_image_destroy (XImage *image)
+{
+#ifdef HAVE_XSHM
+  /* The segment stays in the pool, destroying a shared memory image
+     only frees the structure */
+  if (image->obdata != NULL)
+    ((MetaShmSegment *) image->obdata)->in_use = FALSE;
+#endif
+
+  XDestroyImage (image);
+}
+
+/* Appends a record to the trace, prefixed with the microseconds since
+   the previous one.  The format is described in
+   wm-tester/compositor-replay.c. */
+static void trace_write (MetaCompositorXRender *compositor,
+                         const char            *format,
+                         ...) G_GNUC_PRINTF (2, 3);
+
+static void
+trace_write (MetaCompositorXRender *compositor,
+             const char            *format,
+             ...)
+{
+  gint64 now;
+  va_list args;
+
+  if (compositor->trace == NULL)
+    return;
+
+  now = g_get_monotonic_time ();
+  fprintf (compositor->trace, "%" G_GINT64_FORMAT " ",
+           compositor->trace_time ? now - compositor->trace_time : 0);
+  compositor->trace_time = now;
+
+  va_start (args, format);
+  vfprintf (compositor->trace, format, args);
+  va_end (args);
+
+  fputc ('\n', compositor->trace);
 }
 
 static XImage *
@@ -478,19 +831,10 @@ make_shadow (MetaDisplay   *display,
              int            height)
 {
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
-  Display *xdisplay = meta_display_get_xdisplay (display);
   XImage *ximage;
-  guchar *data;
   shadow *shad;
   int msize;
-  int ylimit, xlimit;
   int swidth, sheight;
-  int centre;
-  int x, y;
-  guchar d;
-  int x_diff;
-  int opacity_int = (int)(opacity * 25);
-  int screen_number = meta_screen_get_screen_number (screen);
 
   if (info==NULL)
     {
@@ -501,128 +845,35 @@ make_shadow (MetaDisplay   *display,
   msize = shad->gaussian_map->size;
   swidth = width + msize;
   sheight = height + msize;
-  centre = msize / 2;
-
-  data = g_malloc (swidth * sheight * sizeof (guchar));
 
-  ximage = XCreateImage (xdisplay, DefaultVisual (xdisplay, screen_number),
-                         8, ZPixmap, 0, (char *) data,
-                         swidth, sheight, 8, swidth * sizeof (guchar));
+  ximage = upload_image_new (display, screen, swidth, sheight, NULL);
   if (!ximage) 
-    {
-      g_free (data);
-      return NULL;
-    }
-
-  /*
-   * Build the gaussian in sections
-   */
-
-  /*
-   * centre (fill the complete data array
-   */
-  if (msize > 0)
-    d = shad->shadow_top[opacity_int * (msize + 1) + msize];
-  else
-    d = sum_gaussian (shad->gaussian_map, opacity, centre, 
-                      centre, width, height);
-  memset (data, d, sheight * swidth);
-
-  /*
-   * corners
-   */
-  ylimit = msize;
-  if (ylimit > sheight / 2)
-    ylimit = (sheight + 1) / 2;
-
-  xlimit = msize;
-  if (xlimit > swidth / 2)
-    xlimit = (swidth + 1) / 2;
+    return NULL;
 
-  for (y = 0; y < ylimit; y++) 
-    {
-      for (x = 0; x < xlimit; x++) 
-        {
-          
-          if (xlimit == msize && ylimit == msize)
-            d = shad->shadow_corner[opacity_int * (msize + 1) * (msize + 1) + y * (msize + 1) + x]; 
-          else
-            d = sum_gaussian (shad->gaussian_map, opacity, x - centre, 
-                              y - centre, width, height);
-          
-          data[y * swidth + x] = d;
-          data[(sheight - y - 1) * swidth + x] = d;
-          data[(sheight - y - 1) * swidth + (swidth - x - 1)] = d;
-          data[y * swidth + (swidth - x - 1)] = d;
-        }
-    }
-  
-  /* top/bottom */
-  x_diff = swidth - (msize * 2);
-  if (x_diff > 0 && ylimit > 0) 
-    {
-      for (y = 0; y < ylimit; y++) 
-        {
-          if (ylimit == msize)
-            d = shad->shadow_top[opacity_int * (msize + 1) + y];
-          else
-            d = sum_gaussian (shad->gaussian_map, opacity, centre, 
-                              y - centre, width, height);
+  meta_shadow_fill (shad->gaussian_map, shad->shadow_corner, shad->shadow_top,
+                    opacity, width, height, (guchar *) ximage->data);
+  upload_image_restride (ximage, swidth, sheight);
 
-          memset (&data[y * swidth + msize], d, x_diff);
-          memset (&data[(sheight - y - 1) * swidth + msize], d, x_diff);
-        }
-    }
-  
-  /*
-   * sides
-   */
-  for (x = 0; x < xlimit; x++) 
-    {
-      if (xlimit == msize)
-        d = shad->shadow_top[opacity_int * (msize + 1) + x];
-      else
-        d = sum_gaussian (shad->gaussian_map, opacity, x - centre, 
-                          centre, width, height);
-    
-      for (y = msize; y < sheight - msize; y++) 
-        {
-          data[y * swidth + x] = d;
-          data[y * swidth + (swidth - x - 1)] = d;
-        }
-    }
-  
   return ximage;
 }
 
+/* Creates a picture holding the shadow image, consuming the image */
 static Picture
-shadow_picture (MetaDisplay   *display,
-                MetaScreen    *screen,
-                MetaShadowType shadow_type,
-                double         opacity,
-                Picture        alpha_pict,
-                int            width,
-                int            height,
-                int           *wp,
-                int           *hp)
+upload_shadow (MetaDisplay *display,
+               MetaScreen  *screen,
+               XImage      *shadow_image)
 {
   Display *xdisplay = meta_display_get_xdisplay (display);
-  XImage *shadow_image;
   Pixmap shadow_pixmap;
   Picture shadow_picture;
   Window xroot = meta_screen_get_xroot (screen);
   GC gc;
 
-  shadow_image = make_shadow (display, screen, shadow_type,
-                              opacity, width, height);
-  if (!shadow_image)
-    return None;
-
   shadow_pixmap = XCreatePixmap (xdisplay, xroot,
                                  shadow_image->width, shadow_image->height, 8);
   if (!shadow_pixmap) 
     {
-      XDestroyImage (shadow_image);
+      upload_image_destroy (shadow_image);
       return None;
     }
 
@@ -632,53 +883,378 @@ PictStandardA8),
                                          0, 0);
   if (!shadow_picture) 
     {
-      XDestroyImage (shadow_image);
+      upload_image_destroy (shadow_image);
       XFreePixmap (xdisplay, shadow_pixmap);
       return None;
     }
+
+  DISPLAY_COMPOSITOR (display)->pictures_created++;
   
   gc = XCreateGC (xdisplay, shadow_pixmap, 0, 0);
   if (!gc) 
     {
-      XDestroyImage (shadow_image);
+      upload_image_destroy (shadow_image);
       XFreePixmap (xdisplay, shadow_pixmap);
       XRenderFreePicture (xdisplay, shadow_picture);
       return None;
     }
 
-  XPutImage (xdisplay, shadow_pixmap, gc, shadow_image, 0, 0, 0, 0,
-             shadow_image->width, shadow_image->height);
-  *wp = shadow_image->width;
-  *hp = shadow_image->height;
+  upload_image_put (display, shadow_pixmap, gc, shadow_image, 0, 0,
+                    shadow_image->width, shadow_image->height);
   
   XFreeGC (xdisplay, gc);
-  XDestroyImage (shadow_image);
+  upload_image_destroy (shadow_image);
   XFreePixmap (xdisplay, shadow_pixmap);
   
   return shadow_picture;
 }
 
-static MetaCompWindow *
-find_window_for_screen (MetaScreen *screen,
-                        Window      xwindow)
+static Picture
+shadow_picture (MetaDisplay   *display,
+                MetaScreen    *screen,
+                MetaShadowType shadow_type,
+                double         opacity,
+                Picture        alpha_pict,
+                int            width,
+                int            height,
+                int           *wp,
+                int           *hp)
 {
-  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  XImage *shadow_image;
 
-  if (info == NULL)
-    return NULL;
-  
-  return g_hash_table_lookup (info->windows_by_xid, (gpointer) xwindow);
-}
+  shadow_image = make_shadow (display, screen, shadow_type,
+                              opacity, width, height);
+  if (!shadow_image)
+    return None;
 
-static MetaCompWindow *
-find_window_in_display (MetaDisplay *display,
-                        Window       xwindow)
-{
-  GSList *index;
+  *wp = shadow_image->width;
+  *hp = shadow_image->height;
 
-  for (index = meta_display_get_screens (display); index; index = index->next) 
-    {
-      MetaCompWindow *cw = find_window_for_screen (index->data, xwindow);
+  return upload_shadow (display, screen, shadow_image);
+}
+
+/* Renders a shadow for the smallest window that still has all of its
+   nine slices (a 1x1 centre) and cuts it into tiles */
+static void
+generate_shadow_slices (MetaScreen    *screen,
+                        MetaShadowType shadow_type)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  shadow *shad = info->shadows[shadow_type];
+  Window xroot = meta_screen_get_xroot (screen);
+  XRenderPictFormat *format;
+  XRenderPictureAttributes pa;
+  XImage *image;
+  GC gc = None;
+  int msize, i;
+
+  msize = shad->gaussian_map->size;
+  format = XRenderFindStandardFormat (xdisplay, PictStandardA8);
+
+  image = make_shadow (display, screen, shadow_type, 1.0, msize + 1, msize + 1);
+  if (!image)
+    return;
+
+  for (i = 0; i < LAST_SHADOW_SLICE; i++)
+    {
+      int col = i % 3, row = i / 3;
+      int x, y, width, height;
+      Pixmap pixmap;
+
+      x = col == 0 ? 0 : (col == 1 ? msize : msize + 1);
+      y = row == 0 ? 0 : (row == 1 ? msize : msize + 1);
+      width = col == 1 ? 1 : msize;
+      height = row == 1 ? 1 : msize;
+
+      if (width == 0 || height == 0)
+        continue;
+
+      pixmap = XCreatePixmap (xdisplay, xroot, width, height, 8);
+      if (!pixmap)
+        continue;
+
+      if (gc == None)
+        gc = XCreateGC (xdisplay, pixmap, 0, 0);
+
+      upload_image_put (display, pixmap, gc, image, x, y, width, height);
+
+      /* Edges and centre are stretched by tiling them */
+      pa.repeat = (col == 1 || row == 1);
+      shad->slices[i] = XRenderCreatePicture (xdisplay, pixmap, format,
+                                              CPRepeat, &pa);
+      XFreePixmap (xdisplay, pixmap);
+    }
+
+  if (gc != None)
+    XFreeGC (xdisplay, gc);
+  upload_image_destroy (image);
+}
+
+static void
+generate_shadows (MetaCompScreen *info)
+{
+  double radii[LAST_SHADOW_TYPE] = {SHADOW_SMALL_RADIUS,
+                                    SHADOW_MEDIUM_RADIUS,
+                                    SHADOW_LARGE_RADIUS};
+  int i;
+
+  for (i = 0; i < LAST_SHADOW_TYPE; i++) {
+    shadow *shad = g_new0 (shadow, 1);
+
+    shad->gaussian_map = meta_shadow_make_gaussian_map (radii[i]);
+    meta_shadow_presum (shad->gaussian_map, &shad->shadow_corner,
+                        &shad->shadow_top);
+
+    info->shadows[i] = shad;
+
+    /* Even when shadows are not built from slices, the slices stand
+       in for shadows that are still being rendered */
+    generate_shadow_slices (info->screen, i);
+  }
+}
+
+static guint
+shadow_cache_entry_hash (gconstpointer v)
+{
+  const MetaShadowCacheEntry *entry = v;
+
+  return ((entry->width * 31 + entry->height) * 31 + entry->opacity) * 31
+    + entry->shadow_type;
+}
+
+static gboolean
+shadow_cache_entry_equal (gconstpointer a,
+                          gconstpointer b)
+{
+  const MetaShadowCacheEntry *ea = a;
+  const MetaShadowCacheEntry *eb = b;
+
+  return (ea->shadow_type == eb->shadow_type &&
+          ea->width == eb->width &&
+          ea->height == eb->height &&
+          ea->opacity == eb->opacity);
+}
+
+static void
+shadow_cache_entry_free (MetaCompScreen       *info,
+                         MetaShadowCacheEntry *entry)
+{
+  MetaDisplay *display = meta_screen_get_display (info->screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+  g_hash_table_remove (info->shadow_cache, entry);
+  g_queue_delete_link (info->shadow_cache_lru, entry->lru_link);
+  info->shadow_cache_size -= entry->shadow_width * entry->shadow_height;
+  if (entry->ref_count == 0)
+    info->shadow_cache_unused -= entry->shadow_width * entry->shadow_height;
+
+  if (entry->job)
+    {
+      entry->job->entry = NULL;
+      info->shadow_jobs_cancelled++;
+    }
+
+  if (entry->picture)
+    XRenderFreePicture (xdisplay, entry->picture);
+  g_free (entry);
+}
+
+/* Evicts the least recently used pictures nobody refers to until the
+   cache fits in its budget */
+static void
+shadow_cache_trim (MetaCompScreen *info)
+{
+  GList *link, *prev;
+
+  for (link = info->shadow_cache_lru->tail; 
+       link && info->shadow_cache_unused > SHADOW_CACHE_BUDGET; 
+       link = prev)
+    {
+      MetaShadowCacheEntry *entry = link->data;
+
+      prev = link->prev;
+      if (entry->ref_count == 0)
+        shadow_cache_entry_free (info, entry);
+    }
+}
+
+static MetaShadowCacheEntry *
+shadow_cache_lookup (MetaScreen    *screen,
+                     MetaShadowType shadow_type,
+                     double         opacity,
+                     int            width,
+                     int            height)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaShadowCacheEntry key, *entry;
+
+  key.shadow_type = shadow_type;
+  key.width = width;
+  key.height = height;
+  key.opacity = (guint) (opacity * 255.0);
+
+  entry = g_hash_table_lookup (info->shadow_cache, &key);
+  if (entry)
+    {
+      info->shadow_cache_hits++;
+
+      g_queue_unlink (info->shadow_cache_lru, entry->lru_link);
+      g_queue_push_head_link (info->shadow_cache_lru, entry->lru_link);
+      if (entry->ref_count == 0)
+        info->shadow_cache_unused -= entry->shadow_width * entry->shadow_height;
+      entry->ref_count++;
+
+      return entry;
+    }
+
+  info->shadow_cache_misses++;
+
+  entry = g_new0 (MetaShadowCacheEntry, 1);
+  entry->shadow_type = key.shadow_type;
+  entry->width = key.width;
+  entry->height = key.height;
+  entry->opacity = key.opacity;
+
+  if (info->shadow_pool != NULL && width * height >= ASYNC_SHADOW_MIN_AREA)
+    {
+      MetaShadowJob *job = g_new0 (MetaShadowJob, 1);
+      int msize = info->shadows[shadow_type]->gaussian_map->size;
+
+      job->entry = entry;
+      job->shad = info->shadows[shadow_type];
+      job->opacity = entry->opacity / 255.0;
+      job->width = width;
+      job->height = height;
+
+      entry->pending = TRUE;
+      entry->job = job;
+      entry->shadow_width = width + msize;
+      entry->shadow_height = height + msize;
+
+      g_thread_pool_push (info->shadow_pool, job, NULL);
+      info->shadow_jobs_queued++;
+    }
+  else
+    {
+      entry->pending = FALSE;
+      entry->job = NULL;
+      entry->picture = shadow_picture (display, screen, shadow_type,
+                                       entry->opacity / 255.0, None,
+                                       width, height,
+                                       &entry->shadow_width,
+                                       &entry->shadow_height);
+    }
+  entry->ref_count = 1;
+
+  g_queue_push_head (info->shadow_cache_lru, entry);
+  entry->lru_link = info->shadow_cache_lru->head;
+  g_hash_table_insert (info->shadow_cache, entry, entry);
+  info->shadow_cache_size += entry->shadow_width * entry->shadow_height;
+
+  shadow_cache_trim (info);
+
+  return entry;
+}
+
+static void
+shadow_cache_release (MetaScreen           *screen,
+                      MetaShadowCacheEntry *entry)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+  g_return_if_fail (entry->ref_count > 0);
+
+  entry->ref_count--;
+  if (entry->ref_count == 0)
+    {
+      info->shadow_cache_unused += entry->shadow_width * entry->shadow_height;
+
+      /* Pictures that failed to be created are not worth keeping,
+         nor are ones still being rendered for nobody */
+      if (entry->picture == None)
+        shadow_cache_entry_free (info, entry);
+      else
+        shadow_cache_trim (info);
+    }
+}
+
+static void
+shadow_cache_destroy (MetaCompScreen *info)
+{
+  while (!g_queue_is_empty (info->shadow_cache_lru))
+    shadow_cache_entry_free (info, g_queue_peek_head (info->shadow_cache_lru));
+
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Shadow cache: %u hits, %u misses\n",
+              info->shadow_cache_hits, info->shadow_cache_misses);
+
+  g_hash_table_destroy (info->shadow_cache);
+  g_queue_free (info->shadow_cache_lru);
+}
+
+static void
+free_shadow (MetaCompWindow *cw)
+{
+  if (cw->shadow_entry)
+    {
+      shadow_cache_release (cw->screen, cw->shadow_entry);
+      cw->shadow_entry = NULL;
+    }
+
+  if (cw->old_shadow_entry)
+    {
+      shadow_cache_release (cw->screen, cw->old_shadow_entry);
+      cw->old_shadow_entry = NULL;
+    }
+
+  cw->shadow = None;
+  cw->shadow_sliced = FALSE;
+}
+
+/* Like free_shadow, but holds on to a finished shadow image so that it
+   can be drawn while the one replacing it is rendered */
+static void
+retire_shadow (MetaCompWindow *cw)
+{
+  MetaShadowCacheEntry *old = cw->old_shadow_entry;
+
+  /* Keep the newest finished image, the current one if it is done */
+  if (cw->shadow_entry != NULL && cw->shadow_entry->picture != None)
+    {
+      old = cw->shadow_entry;
+      cw->shadow_entry = NULL;
+    }
+  else
+    cw->old_shadow_entry = NULL;
+
+  free_shadow (cw);
+  cw->old_shadow_entry = old;
+}
+
+static MetaCompWindow *
+find_window_for_screen (MetaScreen *screen,
+                        Window      xwindow)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (info == NULL)
+    return NULL;
+  
+  return g_hash_table_lookup (info->windows_by_xid, (gpointer) xwindow);
+}
+
+static MetaCompWindow *
+find_window_in_display (MetaDisplay *display,
+                        Window       xwindow)
+{
+  GSList *index;
+
+  for (index = meta_display_get_screens (display); index; index = index->next) 
+    {
+      MetaCompWindow *cw = find_window_for_screen (index->data, xwindow);
 
       if (cw != NULL)
         return cw;
@@ -737,6 +1313,8 @@ solid_picture (MetaDisplay *display,
       return None;
     }
 
+  DISPLAY_COMPOSITOR (display)->pictures_created++;
+
   c.alpha = a * 0xffff;
   c.red = r * 0xffff;
   c.green = g * 0xffff;
@@ -748,28 +1326,22 @@ solid_picture (MetaDisplay *display,
   return picture;
 }
 
-static Picture
-root_tile (MetaScreen *screen)
+/* The pixmap the background setter left in _XROOTPMAP_ID or
+   _XSETROOT_ID, or None */
+static Pixmap
+root_background_pixmap (MetaScreen *screen)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
-  Picture picture;
-  Pixmap pixmap;
-  gboolean fill = FALSE;
-  XRenderPictureAttributes pa;
-  XRenderPictFormat *format;
+  Pixmap pixmap = None;
   int p;
   Atom background_atoms[2];
-  Atom pixmap_atom;
-  int screen_number = meta_screen_get_screen_number (screen);
   Window xroot = meta_screen_get_xroot (screen);
 
-  pixmap = None;
   background_atoms[0] = DISPLAY_COMPOSITOR (display)->atom_x_root_pixmap;
   background_atoms[1] = DISPLAY_COMPOSITOR (display)->atom_x_set_root;
 
-  pixmap_atom = XInternAtom (xdisplay, "PIXMAP", False);
-  for (p = 0; p < 2; p++) 
+  for (p = 0; p < 2 && pixmap == None; p++) 
     {
       Atom actual_type;
       int actual_format;
@@ -782,18 +1354,33 @@ root_tile (MetaScreen *screen)
                               &actual_type, &actual_format, 
                               &nitems, &bytes_after, &prop) == Success)
         {
-          if (actual_type == pixmap_atom &&
+          /* Format 32 property data comes back as longs */
+          if (actual_type == XA_PIXMAP &&
               actual_format == 32 &&
               nitems == 1) 
-            {
-              memcpy (&pixmap, prop, 4);
-              XFree (prop);
-              fill = FALSE;
-              break;
-            }
+            memcpy (&pixmap, prop, sizeof (Pixmap));
+
+          if (prop)
+            XFree (prop);
         } 
     }
 
+  return pixmap;
+}
+
+static Picture
+root_tile (MetaScreen *screen,
+           Pixmap      pixmap)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  Picture picture;
+  gboolean fill = FALSE;
+  XRenderPictureAttributes pa;
+  XRenderPictFormat *format;
+  int screen_number = meta_screen_get_screen_number (screen);
+  Window xroot = meta_screen_get_xroot (screen);
+
   if (!pixmap) 
     {
       pixmap = XCreatePixmap (xdisplay, xroot, 1, 1, 
@@ -824,7 +1411,57 @@ root_tile (MetaScreen *screen)
 
   return picture;
 }
+
+/* Points the root tile at the given background pixmap, keeping the
+   picture if the pixmap is the one it already shows.  Returns whether
+   a new picture was made. */
+static gboolean
+update_root_tile (MetaScreen *screen,
+                  Pixmap      pixmap)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (info->root_tile != None && pixmap == info->root_tile_pixmap)
+    return FALSE;
+
+  if (info->root_tile != None)
+    XRenderFreePicture (xdisplay, info->root_tile);
+
+  info->root_tile = root_tile (screen, pixmap);
+  info->root_tile_pixmap = pixmap;
+  info->root_tile_version++;
+
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Root background is now pixmap 0x%lx, version %u\n",
+              pixmap, info->root_tile_version);
+
+  return TRUE;
+}
   
+/* Size of a pixel of a pixmap of the given depth, from the formats
+   the server listed when we connected */
+static int
+bytes_per_pixel (Display *xdisplay,
+                 int      depth)
+{
+  XPixmapFormatValues *formats;
+  int n_formats, i;
+  int bpp = 32;
+
+  formats = XListPixmapFormats (xdisplay, &n_formats);
+  if (formats == NULL)
+    return bpp / 8;
+
+  for (i = 0; i < n_formats; i++)
+    if (formats[i].depth == depth)
+      bpp = formats[i].bits_per_pixel;
+
+  XFree (formats);
+  return bpp / 8;
+}
+
 static Picture
 create_root_buffer (MetaScreen *screen) 
 {
@@ -854,6 +1491,9 @@ create_root_buffer (MetaScreen *screen)
                                screen_width, screen_height, depth);
   g_return_val_if_fail (root_pixmap != None, None);
 
+  info->root_buffer_age = 0;
+  info->root_buffer_bytes_per_pixel = bytes_per_pixel (xdisplay, depth);
+
   pict = XRenderCreatePicture (xdisplay, root_pixmap, format, 0, NULL);
   XFreePixmap (xdisplay, root_pixmap);
 
@@ -862,12 +1502,12 @@ create_root_buffer (MetaScreen *screen)
 
 static void
 paint_root (MetaScreen *screen,
-            Picture     root_buffer)
+            Picture     root_buffer,
+            XRectangle *bounds)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
-  int width, height;
 
   if (info == NULL)
     {
@@ -878,13 +1518,13 @@ paint_root (MetaScreen *screen,
 
   if (info->root_tile == None) 
     {
-      info->root_tile = root_tile (screen);
+      update_root_tile (screen, root_background_pixmap (screen));
       g_return_if_fail (info->root_tile != None);
     }
   
-  meta_screen_get_size (screen, &width, &height);
   XRenderComposite (xdisplay, PictOpSrc, info->root_tile, None, root_buffer,
-                    0, 0, 0, 0, 0, 0, width, height);
+                    bounds->x, bounds->y, 0, 0, bounds->x, bounds->y,
+                    bounds->width, bounds->height);
 }
 
 static gboolean
@@ -948,6 +1588,29 @@ double shadow_offsets_x[LAST_SHADOW_TYPE] = {SHADOW_SMALL_OFFSET_X,
 double shadow_offsets_y[LAST_SHADOW_TYPE] = {SHADOW_SMALL_OFFSET_Y,
                                              SHADOW_MEDIUM_OFFSET_Y,
                                              SHADOW_LARGE_OFFSET_Y};
+static double
+shadow_opacity (MetaCompWindow *cw)
+{
+  double opacity = SHADOW_OPACITY;
+
+  if (cw->opacity != (guint) OPAQUE)
+    opacity = opacity * ((double) cw->opacity) / ((double) OPAQUE);
+
+  return opacity;
+}
+
+/* How much of its shadow a fading window shows.  Shadows are made
+   for the window's final opacity so that a fade does not need new
+   ones; they are only ever faded down from it. */
+static double
+shadow_fade (MetaCompWindow *cw)
+{
+  if (cw->paint_opacity >= cw->opacity)
+    return 1.0;
+
+  return ((double) cw->paint_opacity) / ((double) cw->opacity);
+}
+
 static XserverRegion
 win_extents (MetaCompWindow *cw)
 {
@@ -968,23 +1631,51 @@ win_extents (MetaCompWindow *cw)
       cw->shadow_dx = shadow_offsets_x [cw->shadow_type];
       cw->shadow_dy = shadow_offsets_y [cw->shadow_type];
 
-      if (!cw->shadow) 
+      if (!cw->shadow_entry && !cw->shadow_sliced) 
         {
-          double opacity = SHADOW_OPACITY;
-          if (cw->opacity != (guint) OPAQUE)
-            opacity = opacity * ((double) cw->opacity) / ((double) OPAQUE);
-          
-          cw->shadow = shadow_picture (display, screen, cw->shadow_type, 
-                                       opacity, cw->alpha_pict,
-                                       cw->attrs.width + cw->attrs.border_width * 2,
-                                       cw->attrs.height + cw->attrs.border_width * 2,
-                                       &cw->shadow_width, &cw->shadow_height);
+          MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+          int width = cw->attrs.width + cw->attrs.border_width * 2;
+          int height = cw->attrs.height + cw->attrs.border_width * 2;
+          int msize = info->shadows[cw->shadow_type]->gaussian_map->size;
+
+          /* Windows smaller than the gaussian get a shadow that is
+             not made of whole slices, so those still need an image */
+          if (info->nine_slice_shadows && width >= msize && height >= msize)
+            {
+              cw->shadow_sliced = TRUE;
+              cw->shadow_width = width + msize;
+              cw->shadow_height = height + msize;
+            }
+          else
+            {
+              cw->shadow_entry = 
+                shadow_cache_lookup (screen, cw->shadow_type,
+                                     shadow_opacity (cw), width, height);
+
+              cw->shadow = cw->shadow_entry->picture;
+              cw->shadow_width = cw->shadow_entry->shadow_width;
+              cw->shadow_height = cw->shadow_entry->shadow_height;
+            }
+
+          if (cw->old_shadow_entry &&
+              !(cw->shadow_entry && cw->shadow_entry->pending))
+            {
+              shadow_cache_release (screen, cw->old_shadow_entry);
+              cw->old_shadow_entry = NULL;
+            }
         }
       
       sr.x = cw->attrs.x + cw->shadow_dx;
       sr.y = cw->attrs.y + cw->shadow_dy;
       sr.width = cw->shadow_width;
       sr.height = cw->shadow_height;
+
+      /* The old shadow is drawn meanwhile, so it is part of the window */
+      if (cw->old_shadow_entry)
+        {
+          sr.width = MAX (sr.width, cw->old_shadow_entry->shadow_width);
+          sr.height = MAX (sr.height, cw->old_shadow_entry->shadow_height);
+        }
       
       if (sr.x < r.x) 
         {
@@ -1044,6 +1735,56 @@ get_window_format (MetaCompWindow *cw)
   return format;
 }
 
+/* Whether the window picture should survive the window being
+   unmapped.  Only done for override redirect windows, which are the
+   menus and tooltips that get shown and hidden all the time. */
+static gboolean
+keep_window_picture (MetaCompWindow *cw)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (cw->screen);
+
+  return info != NULL && info->picture_reuse && cw->attrs.override_redirect;
+}
+
+/* Whether the window can be faded out when it is unmapped, which
+   needs its picture to be of a pixmap that outlives the mapping */
+static gboolean
+window_can_fade_out (MetaCompWindow *cw)
+{
+#ifdef HAVE_NAME_WINDOW_PIXMAP
+  MetaDisplay *display = meta_screen_get_display (cw->screen);
+
+  return have_name_window_pixmap (display) && !keep_window_picture (cw);
+#else
+  return FALSE;
+#endif
+}
+
+/* Where the window picture goes on screen; a picture of a named
+   pixmap includes the window border, one of the window does not */
+static void
+get_picture_geometry (MetaCompWindow *cw,
+                      int            *x,
+                      int            *y,
+                      int            *width,
+                      int            *height)
+{
+  if (cw->picture_on_window)
+    {
+      *x = cw->attrs.x + cw->attrs.border_width;
+      *y = cw->attrs.y + cw->attrs.border_width;
+      *width = cw->attrs.width;
+      *height = cw->attrs.height;
+    }
+  else
+    {
+      *x = cw->attrs.x;
+      *y = cw->attrs.y;
+      *width = cw->attrs.width + cw->attrs.border_width * 2;
+      *height = cw->attrs.height + cw->attrs.border_width * 2;
+    }
+}
+
 static Picture
 get_window_picture (MetaCompWindow *cw)
 {
@@ -1059,7 +1800,10 @@ get_window_picture (MetaCompWindow *cw)
   meta_error_trap_push (display);
 
 #ifdef HAVE_NAME_WINDOW_PIXMAP
-  if (have_name_window_pixmap (display))
+  /* The server gives a window a new pixmap each time it is mapped,
+     so pictures we want to keep across unmaps have to be of the
+     window itself */
+  if (have_name_window_pixmap (display) && !keep_window_picture (cw))
     {
       if (cw->back_pixmap == None)
         cw->back_pixmap = XCompositeNameWindowPixmap (xdisplay, cw->id);
@@ -1079,6 +1823,10 @@ get_window_picture (MetaCompWindow *cw)
       pict = XRenderCreatePicture (xdisplay, draw, format, CPSubwindowMode, &pa);
       meta_error_trap_pop (display, FALSE);
 
+      cw->picture_on_window = (draw == cw->id);
+
+      DISPLAY_COMPOSITOR (display)->pictures_created++;
+
       return pict;
     }
 
@@ -1086,10 +1834,95 @@ get_window_picture (MetaCompWindow *cw)
   return None;
 }
 
+/* Composites the shadow of a window into the buffer, either from its
+   own shadow image or from the nine precomputed slices */
 static void
-paint_dock_shadows (MetaScreen   *screen,
-                    Picture       root_buffer,
-                    XserverRegion region)
+paint_shadow (MetaCompWindow *cw,
+              Picture         root_buffer)
+{
+  MetaScreen *screen = cw->screen;
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  shadow *shad;
+  int x, y, msize, i;
+  int inner_width, inner_height;
+
+  x = cw->attrs.x + cw->shadow_dx;
+  y = cw->attrs.y + cw->shadow_dy;
+
+  if (shadow_fade (cw) < 1.0 && cw->fade_pict == None)
+    cw->fade_pict = solid_picture (display, screen, TRUE,
+                                   shadow_fade (cw), 0, 0, 0);
+
+  if (cw->shadow != None)
+    {
+      XRenderComposite (xdisplay, PictOpOver,
+                        cw->fade_pict ? cw->fade_pict : info->black_picture,
+                        cw->shadow, root_buffer,
+                        0, 0, 0, 0, x, y,
+                        cw->shadow_width, cw->shadow_height);
+      return;
+    }
+
+  if (!cw->shadow_sliced)
+    {
+      /* While the shadow is being rendered, draw the one it replaces
+         or, failing that, put one together from the slices */
+      if (cw->shadow_entry == NULL || !cw->shadow_entry->pending)
+        return;
+
+      if (cw->old_shadow_entry != NULL)
+        {
+          XRenderComposite (xdisplay, PictOpOver,
+                            cw->fade_pict ? cw->fade_pict :
+                            info->black_picture,
+                            cw->old_shadow_entry->picture, root_buffer,
+                            0, 0, 0, 0, x, y,
+                            cw->old_shadow_entry->shadow_width,
+                            cw->old_shadow_entry->shadow_height);
+          return;
+        }
+    }
+
+  /* The slices are at full opacity, the shadow's opacity comes from
+     the source */
+  if (cw->shadow_pict == None)
+    cw->shadow_pict = solid_picture (display, screen, TRUE,
+                                     shadow_opacity (cw) * shadow_fade (cw),
+                                     0, 0, 0);
+
+  shad = info->shadows[cw->shadow_type];
+  msize = shad->gaussian_map->size;
+  inner_width = cw->shadow_width - 2 * msize;
+  inner_height = cw->shadow_height - 2 * msize;
+
+  if (inner_width < 0 || inner_height < 0)
+    return;
+
+  for (i = 0; i < LAST_SHADOW_SLICE; i++)
+    {
+      int col = i % 3, row = i / 3;
+      int dx, dy, width, height;
+
+      dx = col == 0 ? 0 : (col == 1 ? msize : msize + inner_width);
+      dy = row == 0 ? 0 : (row == 1 ? msize : msize + inner_height);
+      width = col == 1 ? inner_width : msize;
+      height = row == 1 ? inner_height : msize;
+
+      if (shad->slices[i] == None || width <= 0 || height <= 0)
+        continue;
+
+      XRenderComposite (xdisplay, PictOpOver, cw->shadow_pict,
+                        shad->slices[i], root_buffer,
+                        0, 0, 0, 0, x + dx, y + dy, width, height);
+    }
+}
+
+static void
+paint_dock_shadows (MetaScreen   *screen,
+                    Picture       root_buffer,
+                    XserverRegion region)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
@@ -1106,7 +1939,10 @@ paint_dock_shadows (MetaScreen   *screen,
       MetaCompWindow *cw = d->data;
       XserverRegion shadow_clip;
 
-      if (cw->shadow)
+      if (cw->culled)
+        continue;
+
+      if (cw->shadow_entry || cw->shadow_sliced)
         {
           shadow_clip = XFixesCreateRegion (xdisplay, NULL, 0);
           XFixesIntersectRegion (xdisplay, shadow_clip, 
@@ -1114,22 +1950,75 @@ paint_dock_shadows (MetaScreen   *screen,
           
           XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0, shadow_clip);
 
-          XRenderComposite (xdisplay, PictOpOver, info->black_picture,
-                            cw->shadow, root_buffer,
-                            0, 0, 0, 0,
-                            cw->attrs.x + cw->shadow_dx,
-                            cw->attrs.y + cw->shadow_dy,
-                            cw->shadow_width, cw->shadow_height);
+          paint_shadow (cw, root_buffer);
           XFixesDestroyRegion (xdisplay, shadow_clip);
         }
     }
 }
 
+/* Checks, without talking to the server, whether the window and its
+   shadow, as large as it is or was this frame, lie in the region with
+   the given relation */
+static gboolean
+window_in_region (MetaCompWindow *cw,
+                  Region          region,
+                  int             relation)
+{
+  int x, y, width, height;
+
+  x = cw->attrs.x;
+  y = cw->attrs.y;
+  width = cw->attrs.width + cw->attrs.border_width * 2;
+  height = cw->attrs.height + cw->attrs.border_width * 2;
+
+  if (XRectInRegion (region, x, y, width, height) != relation)
+    return FALSE;
+
+  if (cw->needs_shadow)
+    {
+      /* We don't know how far the shadow reaches until it exists */
+      if (cw->shadow_width == 0 || cw->shadow_height == 0)
+        return FALSE;
+
+      width = cw->shadow_width;
+      height = cw->shadow_height;
+      if (cw->old_shadow_entry)
+        {
+          width = MAX (width, cw->old_shadow_entry->shadow_width);
+          height = MAX (height, cw->old_shadow_entry->shadow_height);
+        }
+
+      if (XRectInRegion (region, x + cw->shadow_dx, y + cw->shadow_dy,
+                         width, height) != relation)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Whether the window lies entirely inside the area covered by opaque
+   windows */
+static gboolean
+window_is_occluded (MetaCompWindow *cw,
+                    Region          opaque)
+{
+  return window_in_region (cw, opaque, RectangleIn);
+}
+
+/* Whether the window lies entirely outside the damaged area */
+static gboolean
+window_is_undamaged (MetaCompWindow *cw,
+                     Region          damage)
+{
+  return window_in_region (cw, damage, RectangleOut);
+}
+
 static void
 paint_windows (MetaScreen   *screen,
                GList        *windows,
                Picture       root_buffer,
-               XserverRegion region)
+               XserverRegion region,
+               Region        damage)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
@@ -1138,12 +2027,18 @@ paint_windows (MetaScreen   *screen,
   int screen_width, screen_height;
   MetaCompWindow *cw;
   XserverRegion paint_region, desktop_region;
+  XRectangle bounds;
+  Region opaque;
 
   if (info == NULL)
     {
       return;
     }
 
+  info->windows_painted = 0;
+  info->windows_culled = 0;
+  info->windows_undamaged = 0;
+
   meta_screen_get_size (screen, &screen_width, &screen_height);
 
   if (region == None) 
@@ -1163,6 +2058,10 @@ paint_windows (MetaScreen   *screen,
 
   desktop_region = None;
 
+  /* Client side copy of the area covered by the opaque windows
+     painted so far, used to skip hidden windows entirely */
+  opaque = XCreateRegion ();
+
   /*
    * Painting from top to bottom, reducing the clipping area at 
    * each iteration. Only the opaque windows are painted 1st.
@@ -1174,6 +2073,7 @@ paint_windows (MetaScreen   *screen,
       last = index;
 
       cw = (MetaCompWindow *) index->data;
+      cw->culled = FALSE;
       if (!cw->damaged) 
         {
           /* Not damaged */
@@ -1190,9 +2090,6 @@ paint_windows (MetaScreen   *screen,
         }
 #endif
 
-      if (cw->picture == None) 
-        cw->picture = get_window_picture (cw);
-
       /* If the clip region of the screen has been changed
          then we need to recreate the extents of the window */
       if (info->clip_changed) 
@@ -1211,6 +2108,25 @@ paint_windows (MetaScreen   *screen,
             }
 #endif
         }
+
+      if (window_is_undamaged (cw, damage))
+        {
+          cw->culled = TRUE;
+          info->windows_undamaged++;
+          continue;
+        }
+
+      if (window_is_occluded (cw, opaque))
+        {
+          cw->culled = TRUE;
+          info->windows_culled++;
+          continue;
+        }
+
+      info->windows_painted++;
+
+      if (cw->picture == None) 
+        cw->picture = get_window_picture (cw);
       
       if (cw->border_size == None)
         cw->border_size = border_size (cw);
@@ -1222,22 +2138,7 @@ paint_windows (MetaScreen   *screen,
         {
           int x, y, wid, hei;
           
-#ifdef HAVE_NAME_WINDOW_PIXMAP
-          if (have_name_window_pixmap (display))
-            {
-              x = cw->attrs.x;
-              y = cw->attrs.y;
-              wid = cw->attrs.width + cw->attrs.border_width * 2;
-              hei = cw->attrs.height + cw->attrs.border_width * 2;
-            }
-          else
-#endif
-            {
-              x = cw->attrs.x + cw->attrs.border_width;
-              y = cw->attrs.y + cw->attrs.border_width;
-              wid = cw->attrs.width;
-              hei = cw->attrs.height;
-            }
+          get_picture_geometry (cw, &x, &y, &wid, &hei);
           
           XFixesSetPictureClipRegion (xdisplay, root_buffer, 
                                       0, 0, paint_region);
@@ -1253,6 +2154,17 @@ paint_windows (MetaScreen   *screen,
 
           XFixesSubtractRegion (xdisplay, paint_region, 
                                 paint_region, cw->border_size);
+
+          if (!cw->shaped)
+            {
+              XRectangle r;
+
+              r.x = cw->attrs.x + cw->attrs.border_width;
+              r.y = cw->attrs.y + cw->attrs.border_width;
+              r.width = cw->attrs.width;
+              r.height = cw->attrs.height;
+              XUnionRectWithRegion (&r, opaque, opaque);
+            }
         }
       
       if (!cw->border_clip) 
@@ -1263,7 +2175,8 @@ paint_windows (MetaScreen   *screen,
     }
   
   XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0, paint_region);
-  paint_root (screen, root_buffer);
+  XClipBox (damage, &bounds);
+  paint_root (screen, root_buffer, &bounds);
 
   paint_dock_shadows (screen, root_buffer, desktop_region == None ?
                       paint_region : desktop_region);
@@ -1276,10 +2189,14 @@ paint_windows (MetaScreen   *screen,
   for (index = last; index; index = index->prev) 
     { 
       cw = (MetaCompWindow *) index->data;
+
+      if (cw->culled)
+        continue;
       
       if (cw->picture) 
         {
-          if (cw->shadow && cw->type != META_COMP_WINDOW_DOCK) 
+          if ((cw->shadow_entry || cw->shadow_sliced) &&
+              cw->type != META_COMP_WINDOW_DOCK) 
             {
               XserverRegion shadow_clip;
 
@@ -1289,20 +2206,16 @@ paint_windows (MetaScreen   *screen,
               XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0, 
                                           shadow_clip);
               
-              XRenderComposite (xdisplay, PictOpOver, info->black_picture,
-                                cw->shadow, root_buffer,
-                                0, 0, 0, 0,
-                                cw->attrs.x + cw->shadow_dx,
-                                cw->attrs.y + cw->shadow_dy,
-                                cw->shadow_width, cw->shadow_height);
+              paint_shadow (cw, root_buffer);
               if (shadow_clip)
                 XFixesDestroyRegion (xdisplay, shadow_clip);
             }
 
-          if ((cw->opacity != (guint) OPAQUE) && !(cw->alpha_pict)) 
+          if ((cw->paint_opacity != (guint) OPAQUE) && !(cw->alpha_pict)) 
             {
               cw->alpha_pict = solid_picture (display, screen, FALSE,
-                                              (double) cw->opacity / OPAQUE,
+                                              (double) cw->paint_opacity /
+                                              OPAQUE,
                                               0, 0, 0);
             }
           
@@ -1313,22 +2226,8 @@ paint_windows (MetaScreen   *screen,
           if (cw->mode == WINDOW_ARGB) 
             {
               int x, y, wid, hei;
-#ifdef HAVE_NAME_WINDOW_PIXMAP
-              if (have_name_window_pixmap (display))
-                {
-                  x = cw->attrs.x;
-                  y = cw->attrs.y;
-                  wid = cw->attrs.width + cw->attrs.border_width * 2;
-                  hei = cw->attrs.height + cw->attrs.border_width * 2;
-                }
-              else
-#endif
-                {
-                  x = cw->attrs.x + cw->attrs.border_width;
-                  y = cw->attrs.y + cw->attrs.border_width;
-                  wid = cw->attrs.width;
-                  hei = cw->attrs.height;
-                }
+
+              get_picture_geometry (cw, &x, &y, &wid, &hei);
               
               XRenderComposite (xdisplay, PictOpOver, cw->picture, 
                                 cw->alpha_pict, root_buffer, 0, 0, 0, 0,
@@ -1344,22 +2243,62 @@ paint_windows (MetaScreen   *screen,
     }
 
   XFixesDestroyRegion (xdisplay, paint_region);
+  XDestroyRegion (opaque);
+
+  info->total_windows_painted += info->windows_painted;
+  info->total_windows_culled += info->windows_culled;
+  info->total_windows_undamaged += info->windows_undamaged;
+
+  if (DISPLAY_COMPOSITOR (display)->debug)
+    fprintf (stderr, "paint_windows: %u painted, %u culled, %u undamaged\n",
+             info->windows_painted, info->windows_culled,
+             info->windows_undamaged);
 }
 
-static void
+/* Paints the damaged region, given both as a server side region and
+   a client side copy of it, and returns the number of bytes copied to
+   the screen */
+static guint64
 paint_all (MetaScreen   *screen,
-           XserverRegion region)
+           XserverRegion region,
+           Region        damage,
+           guint64       area)
 {
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
   int screen_width, screen_height;
+  XRectangle bounds;
+
+  meta_screen_get_size (screen, &screen_width, &screen_height);
+
+  if (info->root_buffer == None) 
+    info->root_buffer = create_root_buffer (screen);
+
+  /* Nothing in a new root buffer can be kept, whatever the damage */
+  if (info->root_buffer_age == 0)
+    {
+      XRectangle r;
+
+      r.x = 0;
+      r.y = 0;
+      r.width = screen_width;
+      r.height = screen_height;
+      XFixesSetRegion (xdisplay, region, &r, 1);
+      XUnionRectWithRegion (&r, damage, damage);
+      area = (guint64) screen_width * screen_height;
+    }
+
+  /* By the damaged area itself, not its bounding box */
+  XClipBox (damage, &bounds);
+  if (area >= (guint64) screen_width * screen_height)
+    info->frames_full++;
+  else
+    info->frames_partial++;
 
   /* Set clipping to the given region */
   XFixesSetPictureClipRegion (xdisplay, info->root_picture, 0, 0, region);
 
-  meta_screen_get_size (screen, &screen_width, &screen_height);
-
   if (DISPLAY_COMPOSITOR (display)->show_redraw)
     {
       Picture overlay;
@@ -1379,15 +2318,93 @@ paint_all (MetaScreen   *screen,
       usleep (100 * 1000);
     }
   
-  if (info->root_buffer == None) 
-    info->root_buffer = create_root_buffer (screen);
-      
-  paint_windows (screen, info->windows, info->root_buffer, region);
+  paint_windows (screen, info->windows, info->root_buffer, region, damage);
 
+  /* Only the damaged part of the root buffer is copied to the screen */
   XFixesSetPictureClipRegion (xdisplay, info->root_buffer, 0, 0, region);
   XRenderComposite (xdisplay, PictOpSrc, info->root_buffer, None,
-                    info->root_picture, 0, 0, 0, 0, 0, 0, 
-                    screen_width, screen_height);
+                    info->root_picture, bounds.x, bounds.y, 0, 0,
+                    bounds.x, bounds.y, bounds.width, bounds.height);
+
+  info->root_buffer_age = 1;
+
+  return area * info->root_buffer_bytes_per_pixel;
+}
+
+static void process_pending_damage (MetaScreen *screen);
+static void update_unredirection (MetaScreen *screen);
+static void step_fades (MetaScreen *screen,
+                        gint64      now);
+static gboolean start_fade (MetaCompWindow *cw,
+                            guint           from,
+                            gboolean        unmap);
+#ifdef USE_IDLE_REPAINT
+static void schedule_repaint (MetaDisplay *display,
+                              gboolean     urgent);
+#endif
+
+/* Makes a client side copy of a region, clipped to the screen, and
+   counts the pixels in it.  This costs a round trip, which we only
+   pay once a frame. */
+static Region
+fetch_damage (Display      *xdisplay,
+              XserverRegion region,
+              int           screen_width,
+              int           screen_height,
+              guint64      *area)
+{
+  Region damage = XCreateRegion ();
+  XRectangle *rects;
+  int n_rects, i;
+
+  *area = 0;
+
+  rects = XFixesFetchRegion (xdisplay, region, &n_rects);
+  if (rects == NULL)
+    return damage;
+
+  for (i = 0; i < n_rects; i++)
+    {
+      XRectangle r;
+      int x1 = MAX (rects[i].x, 0);
+      int y1 = MAX (rects[i].y, 0);
+      int x2 = MIN (rects[i].x + rects[i].width, screen_width);
+      int y2 = MIN (rects[i].y + rects[i].height, screen_height);
+
+      if (x1 >= x2 || y1 >= y2)
+        continue;
+
+      r.x = x1;
+      r.y = y1;
+      r.width = x2 - x1;
+      r.height = y2 - y1;
+      XUnionRectWithRegion (&r, damage, damage);
+
+      /* The rectangles of a region never overlap */
+      *area += (guint64) r.width * r.height;
+    }
+
+  XFree (rects);
+  return damage;
+}
+
+/* This is the time taken to issue the paint requests; the server
+   renders them asynchronously */
+static void
+record_paint_time (MetaCompositorXRender *compositor,
+                   gint64                 duration)
+{
+  int bucket = 0;
+
+  while (bucket < PAINT_TIME_BUCKETS - 1 &&
+         duration >= (gint64) 1000 << bucket)
+    bucket++;
+
+  compositor->paint_time_histogram[bucket]++;
+  compositor->paint_time_total += duration;
+  if (duration > compositor->paint_time_max)
+    compositor->paint_time_max = duration;
+  compositor->paints++;
 }
 
 static void
@@ -1396,11 +2413,64 @@ repair_screen (MetaScreen *screen)
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
 
-  if (info!=NULL && info->all_damage != None) 
+  if (info == NULL)
+    return;
+
+  meta_error_trap_push (display);
+  process_pending_damage (screen);
+  update_unredirection (screen);
+  meta_error_trap_pop (display, FALSE);
+
+  /* Nothing we paint would be visible, the window covers it all */
+  if (info->unredirected != NULL && info->all_damage != None)
     {
+      XFixesDestroyRegion (xdisplay, info->all_damage);
+      info->all_damage = None;
+    }
+
+  if (info->all_damage != None) 
+    {
+      int screen_width, screen_height;
+      Region damage;
+      guint64 area, bytes;
+      gint64 start, duration;
+
+      meta_screen_get_size (screen, &screen_width, &screen_height);
+
       meta_error_trap_push (display);
-      paint_all (screen, info->all_damage);
+      damage = fetch_damage (xdisplay, info->all_damage,
+                             screen_width, screen_height, &area);
+      if (compositor->count_damaged_pixels || compositor->debug)
+        compositor->damaged_pixels += area;
+
+      start = g_get_monotonic_time ();
+      bytes = paint_all (screen, info->all_damage, damage, area);
+      duration = g_get_monotonic_time () - start;
+      record_paint_time (compositor, duration);
+      XDestroyRegion (damage);
+
+      if (compositor->trace)
+        {
+          trace_write (compositor, "F %d %" G_GINT64_FORMAT " %"
+                       G_GUINT64_FORMAT " %u %u",
+                       meta_screen_get_screen_number (screen), duration,
+                       area, info->windows_painted, info->windows_culled);
+
+          /* Keep the trace whole however we are stopped */
+          fflush (compositor->trace);
+        }
+
+      compositor->bytes_composited += bytes;
+      compositor->bytes_composited_last = bytes;
+      if (bytes > compositor->bytes_composited_max)
+        compositor->bytes_composited_max = bytes;
+
+      if (compositor->debug)
+        fprintf (stderr, "repair_screen: %" G_GUINT64_FORMAT
+                 " bytes composited\n", bytes);
+
       XFixesDestroyRegion (xdisplay, info->all_damage);
       info->all_damage = None;
       info->clip_changed = FALSE;
@@ -1409,97 +2479,343 @@ repair_screen (MetaScreen *screen)
 }
 
 static void
-repair_display (MetaDisplay *display)
+repair_display (MetaDisplay *display)
+{
+  GSList *screens = meta_display_get_screens (display);
+  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+  GSList *index;
+
+  /* Stepping the fades damages the windows, which would schedule
+     another frame if it were not done before this one is taken */
+  if (compositor->fade_time > 0)
+    {
+      gint64 now = g_get_monotonic_time ();
+
+      for (index = screens; index; index = index->next)
+        step_fades ((MetaScreen *) index->data, now);
+    }
+
+#ifdef USE_IDLE_REPAINT
+  if (compositor->repaint_id > 0) 
+    {
+      g_source_remove (compositor->repaint_id);
+      compositor->repaint_id = 0;
+    }
+#endif
+
+  for (; screens; screens = screens->next)
+    repair_screen ((MetaScreen *) screens->data);
+}
+
+#ifdef USE_IDLE_REPAINT
+static gboolean
+compositor_idle_cb (gpointer data)
+{
+  MetaCompositorXRender *compositor = (MetaCompositorXRender *) data;
+  GSList *screens;
+  gint64 start, end;
+
+  compositor->repaint_id = 0;
+
+  start = g_get_monotonic_time ();
+  repair_display (compositor->display);
+  end = g_get_monotonic_time ();
+
+  if (compositor->frame_interval > 0)
+    {
+      /* Every frame interval that went by between the deadline and
+         the end of the paint is a frame we failed to deliver */
+      gint64 late = end - compositor->frame_deadline;
+
+      if (late >= compositor->frame_interval)
+        compositor->frames_dropped += late / compositor->frame_interval;
+    }
+
+  compositor->last_frame_time = start;
+  compositor->frames_painted++;
+
+  /* Fades keep the frame clock running until they are over */
+  for (screens = meta_display_get_screens (compositor->display);
+       screens; screens = screens->next)
+    {
+      MetaCompScreen *info =
+        meta_screen_get_compositor_data ((MetaScreen *) screens->data);
+
+      if (info != NULL && info->fading_windows != NULL)
+        {
+          schedule_repaint (compositor->display, FALSE);
+          break;
+        }
+    }
+
+  if (compositor->debug && compositor->frames_painted % 100 == 0)
+    fprintf (stderr, "frame clock: %u painted, %u coalesced, %u dropped\n",
+             compositor->frames_painted, compositor->frames_coalesced,
+             compositor->frames_dropped);
+
+  return FALSE;
+}
+
+/* Schedules a repaint on the frame clock.  Normal damage is painted
+   on the next frame boundary; urgent (input driven) damage is painted
+   within INPUT_FRAME_DEADLINE regardless of the frame clock. */
+static void
+schedule_repaint (MetaDisplay *display,
+                  gboolean     urgent)
+{
+  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+  gint64 now, deadline;
+
+  now = g_get_monotonic_time ();
+
+  deadline = compositor->last_frame_time + compositor->frame_interval;
+  if (deadline < now)
+    deadline = now;
+
+  if (urgent && deadline > now + INPUT_FRAME_DEADLINE)
+    deadline = now + INPUT_FRAME_DEADLINE;
+
+  if (compositor->repaint_id > 0)
+    {
+      compositor->frames_coalesced++;
+
+      /* The damage will be picked up by the frame already scheduled,
+         unless it has to be painted sooner than that */
+      if (deadline >= compositor->frame_deadline)
+        return;
+
+      g_source_remove (compositor->repaint_id);
+      compositor->repaint_id = 0;
+    }
+
+  compositor->frame_deadline = deadline;
+
+  if (deadline <= now)
+    compositor->repaint_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                                              compositor_idle_cb, compositor,
+                                              NULL);
+  else
+    compositor->repaint_id = g_timeout_add_full (G_PRIORITY_HIGH,
+                                                 (deadline - now + 999) / 1000,
+                                                 compositor_idle_cb, compositor,
+                                                 NULL);
+}
+
+static void
+add_repair (MetaDisplay *display)
+{
+  schedule_repaint (display, FALSE);
+}
+#endif
+
+/* Merges the region into the damage of the next frame, taking
+   ownership of it */
+static void
+accumulate_damage (MetaScreen     *screen,
+                   XserverRegion   damage)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+  /*  dump_xserver_region ("add_damage", display, damage); */
+
+  if (info != NULL && info->all_damage)
+    {
+      XFixesUnionRegion (xdisplay, info->all_damage, info->all_damage, damage);
+      XFixesDestroyRegion (xdisplay, damage);
+    } 
+  else
+    info->all_damage = damage;
+}
+
+static void
+add_damage (MetaScreen     *screen,
+            XserverRegion   damage)
+{
+  accumulate_damage (screen, damage);
+
+#ifdef USE_IDLE_REPAINT
+  add_repair (meta_screen_get_display (screen));
+#endif
+}
+
+static void
+damage_screen (MetaScreen *screen)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  XserverRegion region;
+  int width, height;
+  XRectangle r;
+
+  r.x = 0;
+  r.y = 0;
+  meta_screen_get_size (screen, &width, &height);
+  r.width = width;
+  r.height = height;
+
+  region = XFixesCreateRegion (xdisplay, &r, 1);
+  dump_xserver_region ("damage_screen", display, region);
+  add_damage (screen, region);
+}
+
+static void
+show_overlay_window (MetaScreen *screen,
+                     Window      cow)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+#ifdef HAVE_COW
+  if (have_cow (display))
+    {
+      XserverRegion region;
+
+      region = XFixesCreateRegion (xdisplay, NULL, 0);
+      
+      XFixesSetWindowShapeRegion (xdisplay, cow, ShapeBounding, 0, 0, 0);
+      XFixesSetWindowShapeRegion (xdisplay, cow, ShapeInput, 0, 0, region);
+      
+      XFixesDestroyRegion (xdisplay, region);
+      
+      damage_screen (screen);
+    }
+#endif
+}
+
+static void
+hide_overlay_window (MetaScreen *screen,
+                     Window      cow)
 {
-  GSList *screens = meta_display_get_screens (display);
-  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+#ifdef HAVE_COW
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  XserverRegion region;
 
-#ifdef USE_IDLE_REPAINT
-  if (compositor->repaint_id > 0) 
-    {
-      g_source_remove (compositor->repaint_id);
-      compositor->repaint_id = 0;
-    }
+  region = XFixesCreateRegion (xdisplay, NULL, 0);
+  XFixesSetWindowShapeRegion (xdisplay, cow, ShapeBounding, 0, 0, region);
+  XFixesDestroyRegion (xdisplay, region);
 #endif
-
-  for (; screens; screens = screens->next)
-    repair_screen ((MetaScreen *) screens->data);
 }
 
-#ifdef USE_IDLE_REPAINT
 static gboolean
-compositor_idle_cb (gpointer data)
+window_covers_screen (MetaCompWindow *cw)
 {
-  MetaCompositorXRender *compositor = (MetaCompositorXRender *) data;
+  int screen_width, screen_height;
 
-  compositor->repaint_id = 0;
-  repair_display (compositor->display);
+  meta_screen_get_size (cw->screen, &screen_width, &screen_height);
 
-  return FALSE;
+  return (cw->attrs.x <= 0 && cw->attrs.y <= 0 &&
+          cw->attrs.x + cw->attrs.width + cw->attrs.border_width * 2 
+            >= screen_width &&
+          cw->attrs.y + cw->attrs.height + cw->attrs.border_width * 2 
+            >= screen_height);
 }
 
+/* Lets the topmost window paint directly to the screen when it is
+   opaque, unshaped and covers the whole screen, and redirects it again
+   as soon as any of that stops being true */
 static void
-add_repair (MetaDisplay *display)
+update_unredirection (MetaScreen *screen)
 {
-  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaCompWindow *top = NULL;
+  GList *index;
 
-  if (compositor->repaint_id > 0)
+  if (info == NULL)
     return;
 
-#if 1
-  compositor->repaint_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
-                                            compositor_idle_cb, compositor,
-                                            NULL);
-#else
-  /* Limit it to 50fps */
-  compositor->repaint_id = g_timeout_add_full (G_PRIORITY_HIGH, 20,
-                                               compositor_idle_cb, compositor,
-                                               NULL);
-#endif
-}
-#endif
+  for (index = info->windows; index; index = index->next)
+    {
+      MetaCompWindow *cw = (MetaCompWindow *) index->data;
 
-static void
-add_damage (MetaScreen     *screen,
-            XserverRegion   damage)
-{
-  MetaDisplay *display = meta_screen_get_display (screen);
-  Display *xdisplay = meta_display_get_xdisplay (display);
-  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+      if (cw->attrs.map_state == IsViewable && cw->attrs.class != InputOnly)
+        {
+          top = cw;
+          break;
+        }
+    }
 
-  /*  dump_xserver_region ("add_damage", display, damage); */
+  if (top != NULL &&
+      !(info->unredirect_enabled &&
+        top->mode == WINDOW_SOLID &&
+        !top->shaped &&
+        window_covers_screen (top)))
+    top = NULL;
 
-  if (info != NULL && info->all_damage)
+  if (top == info->unredirected)
+    return;
+
+  if (info->unredirected != NULL)
     {
-      XFixesUnionRegion (xdisplay, info->all_damage, info->all_damage, damage);
-      XFixesDestroyRegion (xdisplay, damage);
-    } 
-  else
-    info->all_damage = damage;
+      MetaCompWindow *cw = info->unredirected;
 
-#ifdef USE_IDLE_REPAINT
-  add_repair (display);
+      meta_verbose ("Redirecting window 0x%lx again\n", cw->id);
+      XCompositeRedirectWindow (xdisplay, cw->id, CompositeRedirectManual);
+      info->unredirected = NULL;
+
+      /* The window gets a new pixmap, and all of it needs painting */
+      cw->damaged = FALSE;
+      show_overlay_window (screen, info->output);
+      damage_screen (screen);
+    }
+
+  if (top != NULL)
+    {
+      meta_verbose ("Unredirecting fullscreen window 0x%lx\n", top->id);
+
+      if (top->picture)
+        {
+          XRenderFreePicture (xdisplay, top->picture);
+          top->picture = None;
+        }
+
+#ifdef HAVE_NAME_WINDOW_PIXMAP
+      if (top->back_pixmap)
+        {
+          XFreePixmap (xdisplay, top->back_pixmap);
+          top->back_pixmap = None;
+        }
 #endif
+
+      XCompositeUnredirectWindow (xdisplay, top->id, CompositeRedirectManual);
+
+      /* Without an overlay window we paint on the root window, and
+         simply stop doing so while the window is unredirected */
+      if (info->output != meta_screen_get_xroot (screen))
+        hide_overlay_window (screen, info->output);
+
+      info->unredirected = top;
+    }
 }
 
+/* Only when tracing: this is a round trip for every damaged window */
 static void
-damage_screen (MetaScreen *screen)
+trace_damage (MetaCompWindow *cw,
+              XserverRegion   parts)
 {
-  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaDisplay *display = meta_screen_get_display (cw->screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
-  XserverRegion region;
-  int width, height;
-  XRectangle r;
+  XRectangle *rects;
+  GString *line;
+  int n_rects, i;
 
-  r.x = 0;
-  r.y = 0;
-  meta_screen_get_size (screen, &width, &height);
-  r.width = width;
-  r.height = height;
+  rects = XFixesFetchRegion (xdisplay, parts, &n_rects);
+  if (rects == NULL)
+    return;
 
-  region = XFixesCreateRegion (xdisplay, &r, 1);
-  dump_xserver_region ("damage_screen", display, region);
-  add_damage (screen, region);
+  line = g_string_new (NULL);
+  for (i = 0; i < n_rects; i++)
+    g_string_append_printf (line, " %d %d %d %d", rects[i].x, rects[i].y,
+                            rects[i].width, rects[i].height);
+  XFree (rects);
+
+  trace_write (DISPLAY_COMPOSITOR (display), "D 0x%lx %d%s",
+               cw->id, n_rects, line->str);
+  g_string_free (line, TRUE);
 }
 
 static void
@@ -1515,11 +2831,19 @@ repair_win (MetaCompWindow *cw)
     {
       parts = win_extents (cw);
       XDamageSubtract (xdisplay, cw->damage, None, None);
+
+      if (cw->needs_fade_in)
+        {
+          cw->needs_fade_in = FALSE;
+          start_fade (cw, 0, FALSE);
+        }
     } 
   else 
     {
       parts = XFixesCreateRegion (xdisplay, 0, 0);
       XDamageSubtract (xdisplay, cw->damage, None, parts);
+      if (DISPLAY_COMPOSITOR (display)->trace)
+        trace_damage (cw, parts);
       XFixesTranslateRegion (xdisplay, parts,
                              cw->attrs.x + cw->attrs.border_width,
                              cw->attrs.y + cw->attrs.border_width);
@@ -1528,8 +2852,69 @@ repair_win (MetaCompWindow *cw)
   meta_error_trap_pop (display, FALSE);
 
   dump_xserver_region ("repair_win", display, parts);
-  add_damage (screen, parts);
+  accumulate_damage (screen, parts);
   cw->damaged = TRUE;
+  cw->thumbnail_stale = TRUE;
+}
+
+/* Fetches the damage of every window which reported some since the
+   last frame: one subtract and one union per window, however many
+   DamageNotify events it sent */
+static void
+process_pending_damage (MetaScreen *screen)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  GSList *index;
+
+  if (info == NULL)
+    return;
+
+  for (index = info->damaged_windows; index; index = index->next)
+    {
+      MetaCompWindow *cw = (MetaCompWindow *) index->data;
+
+      cw->damage_pending = FALSE;
+      DISPLAY_COMPOSITOR (display)->damage_regions++;
+
+      /* The damage must still be cleared or the server would not
+         report any more of it */
+      if (cw->attrs.map_state != IsViewable)
+        XDamageSubtract (xdisplay, cw->damage, None, None);
+      else
+        repair_win (cw);
+    }
+
+  g_slist_free (info->damaged_windows);
+  info->damaged_windows = NULL;
+}
+
+/* Holds on to the picture of a window being unmapped, dropping the
+   pictures of the windows that have been unmapped the longest if
+   there are too many */
+static void
+keep_picture (MetaCompWindow *cw)
+{
+  MetaDisplay *display = meta_screen_get_display (cw->screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (cw->screen);
+
+  if (cw->kept_link == NULL)
+    {
+      g_queue_push_head (info->kept_pictures, cw);
+      cw->kept_link = g_queue_peek_head_link (info->kept_pictures);
+    }
+
+  while (g_queue_get_length (info->kept_pictures) > KEPT_PICTURES_MAX)
+    {
+      MetaCompWindow *old = g_queue_pop_tail (info->kept_pictures);
+
+      old->kept_link = NULL;
+      XRenderFreePicture (xdisplay, old->picture);
+      old->picture = None;
+      info->pictures_evicted++;
+    }
 }
 
 static void
@@ -1558,17 +2943,16 @@ free_win (MetaCompWindow *cw,
     }
 #endif
 
-  if (cw->picture) 
+  if (cw->picture && !destroy && cw->picture_on_window &&
+      keep_window_picture (cw))
+    keep_picture (cw);
+  else if (cw->picture) 
     {
       XRenderFreePicture (xdisplay, cw->picture);
       cw->picture = None;
     }
 
-  if (cw->shadow) 
-    {
-      XRenderFreePicture (xdisplay, cw->shadow);
-      cw->shadow = None;
-    }
+  free_shadow (cw);
 
   if (cw->alpha_pict) 
     {
@@ -1581,6 +2965,12 @@ free_win (MetaCompWindow *cw,
       XRenderFreePicture (xdisplay, cw->shadow_pict);
       cw->shadow_pict = None;
     }
+
+  if (cw->fade_pict)
+    {
+      XRenderFreePicture (xdisplay, cw->fade_pict);
+      cw->fade_pict = None;
+    }
   
   if (cw->border_size) 
     {
@@ -1615,10 +3005,145 @@ free_win (MetaCompWindow *cw,
       if (info!=NULL && cw->type == META_COMP_WINDOW_DOCK)
         info->dock_windows = g_slist_remove (info->dock_windows, cw);
 
+      if (info != NULL && cw->damage_pending)
+        info->damaged_windows = g_slist_remove (info->damaged_windows, cw);
+
+      if (info != NULL && cw->kept_link != NULL)
+        g_queue_delete_link (info->kept_pictures, cw->kept_link);
+
+      if (info != NULL && cw->fading)
+        info->fading_windows = g_slist_remove (info->fading_windows, cw);
+
+      if (cw->thumbnail_pixmap != None)
+        XFreePixmap (xdisplay, cw->thumbnail_pixmap);
+
       g_free (cw);
     }
 }
-  
+
+static void determine_mode (MetaDisplay    *display,
+                            MetaScreen     *screen,
+                            MetaCompWindow *cw);
+
+/* Starts fading the window from the given opacity to its own or, for
+   a window being unmapped, to nothing.  Returns FALSE when fades are
+   turned off. */
+static gboolean
+start_fade (MetaCompWindow *cw,
+            guint           from,
+            gboolean        unmap)
+{
+  MetaScreen *screen = cw->screen;
+  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (info == NULL || DISPLAY_COMPOSITOR (display)->fade_time == 0)
+    return FALSE;
+
+  if (!cw->fading)
+    {
+      info->fading_windows = g_slist_prepend (info->fading_windows, cw);
+      cw->fading = TRUE;
+    }
+
+  cw->fade_from = from;
+  cw->fade_start = g_get_monotonic_time ();
+  cw->fade_unmap = unmap;
+  cw->paint_opacity = from;
+  info->fades_started++;
+
+  determine_mode (display, screen, cw);
+#ifdef USE_IDLE_REPAINT
+  add_repair (display);
+#endif
+
+  return TRUE;
+}
+
+static void
+stop_fade (MetaCompWindow *cw)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (cw->screen);
+
+  if (info != NULL && cw->fading)
+    info->fading_windows = g_slist_remove (info->fading_windows, cw);
+
+  cw->fading = FALSE;
+  cw->fade_unmap = FALSE;
+  cw->paint_opacity = cw->opacity;
+}
+
+/* Lets go of everything an unmapped window was painted with */
+static void
+finish_unmap (MetaCompWindow *cw)
+{
+  MetaScreen *screen = cw->screen;
+  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+  cw->damaged = FALSE;
+
+  if (cw->extents != None) 
+    {
+      dump_xserver_region ("unmap_win", display, cw->extents);
+      add_damage (screen, cw->extents);
+      cw->extents = None;
+    }
+
+  free_win (cw, FALSE);
+  info->clip_changed = TRUE;
+}
+
+/* Moves every fade on to where it should be at the time given,
+   damaging the extents of the windows it changes */
+static void
+step_fades (MetaScreen *screen,
+            gint64      now)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  gint64 fade_time = DISPLAY_COMPOSITOR (display)->fade_time;
+  GSList *index, *next;
+
+  if (info == NULL)
+    return;
+
+  for (index = info->fading_windows; index; index = next)
+    {
+      MetaCompWindow *cw = (MetaCompWindow *) index->data;
+      guint target = cw->fade_unmap ? 0 : cw->opacity;
+      gint64 elapsed = now - cw->fade_start;
+
+      next = index->next;
+
+      /* A window fading out whose contents went away with a resize
+         has nothing left to fade */
+      if (elapsed < fade_time && !(cw->fade_unmap && cw->picture == None))
+        {
+          cw->paint_opacity = cw->fade_from +
+            ((double) target - (double) cw->fade_from) * elapsed / fade_time;
+          determine_mode (display, screen, cw);
+          continue;
+        }
+
+      info->fading_windows = g_slist_delete_link (info->fading_windows,
+                                                  index);
+      cw->fading = FALSE;
+
+      if (cw->fade_unmap)
+        {
+          cw->fade_unmap = FALSE;
+          cw->paint_opacity = cw->opacity;
+          finish_unmap (cw);
+        }
+      else
+        {
+          cw->paint_opacity = target;
+          determine_mode (display, screen, cw);
+        }
+    }
+}
+
 static void
 map_win (MetaDisplay *display,
          MetaScreen  *screen,
@@ -1630,6 +3155,13 @@ map_win (MetaDisplay *display,
   if (cw == NULL)
     return;
 
+  /* Mapped again before it was done fading out */
+  if (cw->fade_unmap)
+    {
+      stop_fade (cw);
+      finish_unmap (cw);
+    }
+
 #ifdef HAVE_NAME_WINDOW_PIXMAP
   /* The reason we deallocate this here and not in unmap
      is so that we will still have a valid pixmap for 
@@ -1647,8 +3179,19 @@ map_win (MetaDisplay *display,
     }
 #endif
 
+  if (cw->kept_link != NULL)
+    {
+      MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+      g_queue_delete_link (info->kept_pictures, cw->kept_link);
+      cw->kept_link = NULL;
+      info->pictures_reused++;
+    }
+
   cw->attrs.map_state = IsViewable;
   cw->damaged = FALSE;
+
+  trace_write (DISPLAY_COMPOSITOR (display), "M 0x%lx", id);
 }
 
 static void
@@ -1664,21 +3207,25 @@ unmap_win (MetaDisplay *display,
       return;
     }
 
+  trace_write (DISPLAY_COMPOSITOR (display), "U 0x%lx", id);
+
   if (cw->window && cw->window == info->focus_window) 
     info->focus_window = NULL;
 
   cw->attrs.map_state = IsUnmapped;
-  cw->damaged = FALSE;
+  cw->needs_fade_in = FALSE;
 
-  if (cw->extents != None) 
+  /* Fade out what was painted last, which needs a picture that
+     outlives the window being mapped */
+  if (cw->damaged && cw->picture != None && !cw->picture_on_window &&
+      cw != info->unredirected && start_fade (cw, cw->paint_opacity, TRUE))
     {
-      dump_xserver_region ("unmap_win", display, cw->extents);
-      add_damage (screen, cw->extents);
-      cw->extents = None;
+      info->clip_changed = TRUE;
+      return;
     }
 
-  free_win (cw, FALSE);
-  info->clip_changed = TRUE;
+  stop_fade (cw);
+  finish_unmap (cw);
 }
 
 static void
@@ -1701,13 +3248,19 @@ determine_mode (MetaDisplay    *display,
       cw->shadow_pict = None;
     }
 
+  if (cw->fade_pict)
+    {
+      XRenderFreePicture (xdisplay, cw->fade_pict);
+      cw->fade_pict = None;
+    }
+
   if (cw->attrs.class == InputOnly)
     format = NULL;
   else
     format = XRenderFindVisualFormat (xdisplay, cw->attrs.visual);
   
   if ((format && format->type == PictTypeDirect && format->direct.alphaMask)
-      || cw->opacity != (guint) OPAQUE)
+      || cw->paint_opacity != (guint) OPAQUE)
     cw->mode = WINDOW_ARGB;
   else
     cw->mode = WINDOW_SOLID;
@@ -1854,6 +3407,7 @@ add_win (MetaScreen *screen,
   cw->border_size = None;
   cw->extents = None;
   cw->shadow = None;
+  cw->shadow_entry = NULL;
   cw->shadow_dx = 0;
   cw->shadow_dy = 0;
   cw->shadow_width = 0;
@@ -1865,6 +3419,18 @@ add_win (MetaScreen *screen,
     cw->shadow_type = META_SHADOW_MEDIUM;
 
   cw->opacity = OPAQUE;
+  cw->paint_opacity = OPAQUE;
+  cw->fade_from = OPAQUE;
+  cw->fade_start = 0;
+  cw->fading = FALSE;
+  cw->fade_unmap = FALSE;
+  cw->needs_fade_in = FALSE;
+  cw->fade_pict = None;
+
+  cw->thumbnail_pixmap = None;
+  cw->thumbnail_width = 0;
+  cw->thumbnail_height = 0;
+  cw->thumbnail_stale = TRUE;
   
   cw->border_clip = None;
 
@@ -1885,6 +3451,12 @@ add_win (MetaScreen *screen,
   info->windows = g_list_prepend (info->windows, cw);
   g_hash_table_insert (info->windows_by_xid, (gpointer) xwindow, cw);
 
+  trace_write (DISPLAY_COMPOSITOR (display), "C 0x%lx %d %d %d %d %d %d %d %d",
+               xwindow, cw->attrs.x, cw->attrs.y, cw->attrs.width,
+               cw->attrs.height, cw->attrs.border_width,
+               cw->attrs.override_redirect, cw->mode == WINDOW_ARGB,
+               meta_screen_get_screen_number (screen));
+
   if (cw->attrs.map_state == IsViewable)
     map_win (display, screen, xwindow);
 }
@@ -1903,6 +3475,8 @@ destroy_win (MetaDisplay *display,
   if (cw == NULL)
     return;
 
+  trace_write (DISPLAY_COMPOSITOR (display), "X 0x%lx", xwindow);
+
   screen = cw->screen;
   
   if (cw->extents != None) 
@@ -1917,6 +3491,14 @@ destroy_win (MetaDisplay *display,
     {
       info->windows = g_list_remove (info->windows, (gconstpointer) cw);
       g_hash_table_remove (info->windows_by_xid, (gpointer) xwindow);
+
+      if (info->unredirected == cw)
+        {
+          /* Nothing to redirect any more, just bring the output back */
+          info->unredirected = NULL;
+          show_overlay_window (screen, info->output);
+          damage_screen (screen);
+        }
     }
   
   free_win (cw, TRUE);
@@ -2049,17 +3631,14 @@ resize_win (MetaCompWindow *cw,
             }
         }
 #endif
-      if (cw->picture) 
+      /* A picture of the window follows it as it is resized */
+      if (cw->picture && !cw->picture_on_window) 
         {
           XRenderFreePicture (xdisplay, cw->picture);
           cw->picture = None;
         }
       
-      if (cw->shadow) 
-        {
-          XRenderFreePicture (xdisplay, cw->shadow);
-          cw->shadow = None;
-        }
+      retire_shadow (cw);
     }
 
   cw->attrs.width = width;
@@ -2067,6 +3646,21 @@ resize_win (MetaCompWindow *cw,
   cw->attrs.border_width = border_width;
   cw->attrs.override_redirect = override_redirect;
 
+  /* A window that stopped being override redirect goes back to
+     having a picture of its named pixmap */
+  if (cw->picture && cw->picture_on_window && !keep_window_picture (cw) &&
+      have_name_window_pixmap (display))
+    {
+      if (cw->kept_link != NULL)
+        {
+          g_queue_delete_link (info->kept_pictures, cw->kept_link);
+          cw->kept_link = NULL;
+        }
+
+      XRenderFreePicture (xdisplay, cw->picture);
+      cw->picture = None;
+    }
+
   if (cw->extents)
     XFixesDestroyRegion (xdisplay, cw->extents);
 
@@ -2119,6 +3713,7 @@ process_circulate_notify (MetaCompositorXRender  *compositor,
     above = top->id;
   else
     above = None;
+  trace_write (compositor, "R 0x%lx 0x%lx", cw->id, above);
   restack_win (cw, above);
 
   if (info != NULL)
@@ -2167,9 +3762,16 @@ process_configure_notify (MetaCompositorXRender  *compositor,
                    event->x, event->y, event->width, event->height);
         }
 
+      trace_write (compositor, "G 0x%lx %d %d %d %d %d 0x%lx", cw->id,
+                   event->x, event->y, event->width, event->height,
+                   event->border_width, event->above);
+
       restack_win (cw, event->above);
       resize_win (cw, event->x, event->y, event->width, event->height,
                   event->border_width, event->override_redirect);
+#ifdef USE_IDLE_REPAINT
+      schedule_repaint (display, TRUE);
+#endif
     }
   else
     { 
@@ -2218,10 +3820,17 @@ process_property_notify (MetaCompositorXRender *compositor,
 
               if (info != NULL && info->root_tile)
                 {
-                  XClearArea (xdisplay, xroot, 0, 0, 0, 0, TRUE);
-                  XRenderFreePicture (xdisplay, info->root_tile);
-                  info->root_tile = None;
-                  
+                  /* Setters change both properties, usually to the
+                     same pixmap, and may redraw that pixmap in place.
+                     The picture is only remade for a new pixmap, but
+                     either way the contents may have changed. */
+                  trace_write (compositor, "B %d",
+                               meta_screen_get_screen_number (screen));
+
+                  if (update_root_tile (screen,
+                                        root_background_pixmap (screen)))
+                    XClearArea (xdisplay, xroot, 0, 0, 0, 0, FALSE);
+
                   /* Damage the whole screen as we may need to redraw the 
                      background ourselves */
                   damage_screen (screen);
@@ -2262,11 +3871,7 @@ process_property_notify (MetaCompositorXRender *compositor,
       determine_mode (display, cw->screen, cw);
       cw->needs_shadow = window_has_shadow (cw);
 
-      if (cw->shadow)
-        {
-          XRenderFreePicture (xdisplay, cw->shadow);
-          cw->shadow = None;
-        }
+      retire_shadow (cw);
 
       if (cw->extents)
         XFixesDestroyRegion (xdisplay, cw->extents);
@@ -2303,14 +3908,18 @@ process_property_notify (MetaCompositorXRender *compositor,
         value = OPAQUE;
 
       cw->opacity = (guint)value;
+      trace_write (compositor, "P 0x%lx %lu", cw->id, value);
+
+      /* Fade to the new opacity, unless the window is fading out */
+      if (!cw->fade_unmap &&
+          !(cw->attrs.map_state == IsViewable && cw->damaged &&
+            start_fade (cw, cw->paint_opacity, FALSE)))
+        cw->paint_opacity = cw->opacity;
+
       determine_mode (display, cw->screen, cw);
       cw->needs_shadow = window_has_shadow (cw);
 
-      if (cw->shadow)
-        {
-          XRenderFreePicture (xdisplay, cw->shadow);
-          cw->shadow = None;
-        }
+      retire_shadow (cw);
 
       if (cw->extents)
         XFixesDestroyRegion (xdisplay, cw->extents);
@@ -2381,6 +3990,9 @@ process_expose (MetaCompositorXRender *compositor,
   rect[0].height = event->height;
   
   expose_area (screen, rect, 1);
+#ifdef USE_IDLE_REPAINT
+  schedule_repaint (compositor->display, TRUE);
+#endif
 }
 
 static void
@@ -2398,7 +4010,12 @@ process_unmap (MetaCompositorXRender *compositor,
 
   cw = find_window_in_display (compositor->display, event->window);
   if (cw)
-    unmap_win (compositor->display, cw->screen, event->window);
+    {
+      unmap_win (compositor->display, cw->screen, event->window);
+#ifdef USE_IDLE_REPAINT
+      schedule_repaint (compositor->display, TRUE);
+#endif
+    }
 }
 
 static void
@@ -2409,7 +4026,15 @@ process_map (MetaCompositorXRender *compositor,
                                                event->window);
 
   if (cw)
-    map_win (compositor->display, cw->screen, event->window);
+    {
+      map_win (compositor->display, cw->screen, event->window);
+
+      /* Windows that would vanish at once on unmap appear at once too */
+      cw->needs_fade_in = window_can_fade_out (cw);
+#ifdef USE_IDLE_REPAINT
+      schedule_repaint (compositor->display, TRUE);
+#endif
+    }
 }
 
 static void
@@ -2456,10 +4081,23 @@ process_damage (MetaCompositorXRender *compositor,
 {
   MetaCompWindow *cw = find_window_in_display (compositor->display,
                                                event->drawable);
+  MetaCompScreen *info;
+
+  compositor->damage_events++;
+
   if (cw == NULL)
     return;
 
-  repair_win (cw);
+  info = meta_screen_get_compositor_data (cw->screen);
+  if (info == NULL)
+    return;
+
+  /* The damage itself is fetched once per frame */
+  if (!cw->damage_pending)
+    {
+      cw->damage_pending = TRUE;
+      info->damaged_windows = g_slist_prepend (info->damaged_windows, cw);
+    }
 
 #ifdef USE_IDLE_REPAINT
   if (event->more == FALSE)
@@ -2491,6 +4129,156 @@ process_shape (MetaCompositorXRender *compositor,
     }
 }
 
+static gboolean shadow_jobs_done_cb (gpointer data);
+
+/* Runs on a worker thread */
+static void
+shadow_job_run (gpointer data,
+                gpointer user_data)
+{
+  MetaShadowJob *job = data;
+  MetaCompScreen *info = user_data;
+  int msize = job->shad->gaussian_map->size;
+
+  job->data = g_malloc ((job->width + msize) * (job->height + msize));
+  meta_shadow_fill (job->shad->gaussian_map, job->shad->shadow_corner,
+                    job->shad->shadow_top, job->opacity,
+                    job->width, job->height, job->data);
+
+  g_mutex_lock (&info->shadow_jobs_lock);
+  info->shadow_jobs_done = g_slist_prepend (info->shadow_jobs_done, job);
+  if (info->shadow_jobs_idle == 0)
+    info->shadow_jobs_idle = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                                              shadow_jobs_done_cb, info,
+                                              NULL);
+  g_mutex_unlock (&info->shadow_jobs_lock);
+}
+
+/* Uploads a finished shadow and has the windows waiting for it swap
+   it in for whatever they were drawing meanwhile */
+static void
+shadow_job_finish (MetaCompScreen *info,
+                   MetaShadowJob  *job)
+{
+  MetaScreen *screen = info->screen;
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaShadowCacheEntry *entry = job->entry;
+  XImage *image;
+  GList *index;
+
+  if (entry == NULL)
+    {
+      g_free (job->data);
+      g_free (job);
+      return;
+    }
+
+  image = upload_image_new (display, screen,
+                            entry->shadow_width, entry->shadow_height,
+                            job->data);
+  if (image)
+    entry->picture = upload_shadow (display, screen, image);
+
+  entry->pending = FALSE;
+  entry->job = NULL;
+  g_free (job);
+
+  for (index = info->windows; index; index = index->next)
+    {
+      MetaCompWindow *cw = index->data;
+      XserverRegion damage = None;
+
+      if (cw->shadow_entry != entry)
+        continue;
+
+      if (cw->extents)
+        {
+          damage = XFixesCreateRegion (xdisplay, NULL, 0);
+          XFixesCopyRegion (xdisplay, damage, cw->extents);
+          XFixesDestroyRegion (xdisplay, cw->extents);
+          cw->extents = None;
+        }
+
+      if (cw->old_shadow_entry)
+        {
+          shadow_cache_release (screen, cw->old_shadow_entry);
+          cw->old_shadow_entry = NULL;
+        }
+
+      cw->shadow = entry->picture;
+
+      if (cw->attrs.map_state == IsViewable)
+        {
+          cw->extents = win_extents (cw);
+
+          if (damage)
+            XFixesUnionRegion (xdisplay, damage, damage, cw->extents);
+          else
+            {
+              damage = XFixesCreateRegion (xdisplay, NULL, 0);
+              XFixesCopyRegion (xdisplay, damage, cw->extents);
+            }
+        }
+
+      if (damage)
+        add_damage (screen, damage);
+    }
+}
+
+static gboolean
+shadow_jobs_done_cb (gpointer data)
+{
+  MetaCompScreen *info = data;
+  MetaDisplay *display = meta_screen_get_display (info->screen);
+  GSList *done, *l;
+
+  g_mutex_lock (&info->shadow_jobs_lock);
+  done = g_slist_reverse (info->shadow_jobs_done);
+  info->shadow_jobs_done = NULL;
+  info->shadow_jobs_idle = 0;
+  g_mutex_unlock (&info->shadow_jobs_lock);
+
+  meta_error_trap_push (display);
+  for (l = done; l; l = l->next)
+    shadow_job_finish (info, l->data);
+  meta_error_trap_pop (display, FALSE);
+
+  g_slist_free (done);
+
+  return FALSE;
+}
+
+/* Waits for the workers and throws away what they rendered */
+static void
+shadow_jobs_shutdown (MetaCompScreen *info)
+{
+  GSList *l;
+
+  if (info->shadow_pool == NULL)
+    return;
+
+  g_thread_pool_free (info->shadow_pool, FALSE, TRUE);
+  info->shadow_pool = NULL;
+
+  if (info->shadow_jobs_idle != 0)
+    g_source_remove (info->shadow_jobs_idle);
+
+  for (l = info->shadow_jobs_done; l; l = l->next)
+    {
+      MetaShadowJob *job = l->data;
+
+      if (job->entry)
+        job->entry->job = NULL;
+
+      g_free (job->data);
+      g_free (job);
+    }
+  g_slist_free (info->shadow_jobs_done);
+
+  g_mutex_clear (&info->shadow_jobs_lock);
+}
+
 static int
 timeout_debug (MetaCompositorXRender *compositor)
 {
@@ -2524,45 +4312,6 @@ xrender_remove_window (MetaCompositor *compositor,
 #endif
 }
 
-static void
-show_overlay_window (MetaScreen *screen,
-                     Window      cow)
-{
-  MetaDisplay *display = meta_screen_get_display (screen);
-  Display *xdisplay = meta_display_get_xdisplay (display);
-
-#ifdef HAVE_COW
-  if (have_cow (display))
-    {
-      XserverRegion region;
-
-      region = XFixesCreateRegion (xdisplay, NULL, 0);
-      
-      XFixesSetWindowShapeRegion (xdisplay, cow, ShapeBounding, 0, 0, 0);
-      XFixesSetWindowShapeRegion (xdisplay, cow, ShapeInput, 0, 0, region);
-      
-      XFixesDestroyRegion (xdisplay, region);
-      
-      damage_screen (screen);
-    }
-#endif
-}
-
-static void
-hide_overlay_window (MetaScreen *screen,
-                     Window      cow)
-{
-#ifdef HAVE_COW
-  MetaDisplay *display = meta_screen_get_display (screen);
-  Display *xdisplay = meta_display_get_xdisplay (display);
-  XserverRegion region;
-
-  region = XFixesCreateRegion (xdisplay, NULL, 0);
-  XFixesSetWindowShapeRegion (xdisplay, cow, ShapeBounding, 0, 0, region);
-  XFixesDestroyRegion (xdisplay, region);
-#endif
-}
-
 static Window
 get_output_window (MetaScreen *screen)
 {
@@ -2630,6 +4379,14 @@ xrender_manage_screen (MetaCompositor *compositor,
 
   info->output = get_output_window (screen);
 
+  {
+    int width, height;
+
+    meta_screen_get_size (screen, &width, &height);
+    trace_write (DISPLAY_COMPOSITOR (display), "S %d %d %d",
+                 screen_number, width, height);
+  }
+
   pa.subwindow_mode = IncludeInferiors;
   info->root_picture = XRenderCreatePicture (xdisplay, info->output,
                                              visual_format, 
@@ -2641,9 +4398,12 @@ xrender_manage_screen (MetaCompositor *compositor,
     }
   
   info->root_buffer = None;
+  info->root_buffer_age = 0;
   info->black_picture = solid_picture (display, screen, TRUE, 1, 0, 0, 0);
 
   info->root_tile = None;
+  info->root_tile_pixmap = None;
+  info->root_tile_version = 0;
   info->all_damage = None;
   
   info->windows = NULL;
@@ -2655,11 +4415,39 @@ xrender_manage_screen (MetaCompositor *compositor,
   info->overlays = 0;
   info->clip_changed = TRUE;
 
+  info->shadow_cache = g_hash_table_new (shadow_cache_entry_hash,
+                                         shadow_cache_entry_equal);
+  info->shadow_cache_lru = g_queue_new ();
+  info->shadow_cache_size = 0;
+  info->shadow_cache_unused = 0;
+
+  info->unredirected = NULL;
+  info->unredirect_enabled = (g_getenv ("META_DEBUG_NO_UNREDIRECT") == NULL);
+
+  info->kept_pictures = g_queue_new ();
+  info->fading_windows = NULL;
+  info->fades_started = 0;
+  info->thumbnails_rendered = 0;
+  info->thumbnails_reused = 0;
+  info->picture_reuse = (g_getenv ("META_DEBUG_NO_PICTURE_REUSE") == NULL);
+
   info->have_shadows = (g_getenv("META_DEBUG_NO_SHADOW") == NULL);
+  info->nine_slice_shadows = 
+    (g_strcmp0 (g_getenv ("METACITY_SHADOW_MODE"), "image") != 0);
   if (info->have_shadows)
     {
-      meta_verbose ("Enabling shadows\n");
+      meta_verbose ("Enabling shadows, using %s kernels\n",
+                    meta_shadow_kernel_name (meta_shadow_get_kernel ()));
       generate_shadows (info);
+
+      /* Big image shadows are rendered off the main loop */
+      if (g_getenv ("META_DEBUG_NO_SHADOW_THREADS") == NULL)
+        {
+          g_mutex_init (&info->shadow_jobs_lock);
+          info->shadow_pool = g_thread_pool_new (shadow_job_run, info,
+                                                 SHADOW_WORKER_THREADS,
+                                                 FALSE, NULL);
+        }
     }
   else
     meta_verbose ("Disabling shadows\n");
@@ -2692,6 +4480,16 @@ xrender_unmanage_screen (MetaCompositor *compositor,
 
   hide_overlay_window (screen, info->output);
 
+  if (info->unredirected != NULL)
+    {
+      XCompositeRedirectWindow (xdisplay, info->unredirected->id,
+                                CompositeRedirectManual);
+      info->unredirected = NULL;
+    }
+
+  /* Nothing the workers render can be used any more */
+  shadow_jobs_shutdown (info);
+
   /* Destroy the windows */
   for (index = info->windows; index; index = index->next) 
     {
@@ -2700,6 +4498,28 @@ xrender_unmanage_screen (MetaCompositor *compositor,
     }
   g_list_free (info->windows);
   g_hash_table_destroy (info->windows_by_xid);
+  g_slist_free (info->damaged_windows);
+  g_queue_free (info->kept_pictures);
+  g_slist_free (info->fading_windows);
+  info->fading_windows = NULL;
+
+  shadow_cache_destroy (info);
+
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Culling: %u windows painted, %u culled, %u undamaged\n",
+              info->total_windows_painted, info->total_windows_culled,
+              info->total_windows_undamaged);
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Frames: %u covering the whole screen, %u partial\n",
+              info->frames_full, info->frames_partial);
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Window pictures: %u reused after unmap, %u evicted\n",
+              info->pictures_reused, info->pictures_evicted);
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Fades: %u started\n", info->fades_started);
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Shadow jobs: %u queued, %u cancelled\n",
+              info->shadow_jobs_queued, info->shadow_jobs_cancelled);
 
   if (info->root_picture)
     XRenderFreePicture (xdisplay, info->root_picture);
@@ -2712,7 +4532,18 @@ xrender_unmanage_screen (MetaCompositor *compositor,
       int i;
       
       for (i = 0; i < LAST_SHADOW_TYPE; i++)
-        g_free (info->shadows[i]->gaussian_map);
+        {
+          int j;
+
+          for (j = 0; j < LAST_SHADOW_SLICE; j++)
+            if (info->shadows[i]->slices[j])
+              XRenderFreePicture (xdisplay, info->shadows[i]->slices[j]);
+
+          g_free (info->shadows[i]->gaussian_map);
+          g_free (info->shadows[i]->shadow_corner);
+          g_free (info->shadows[i]->shadow_top);
+          g_free (info->shadows[i]);
+        }
     }
 
   XCompositeUnredirectSubwindows (xdisplay, xroot,
@@ -2743,6 +4574,47 @@ static void
 xrender_destroy (MetaCompositor *compositor)
 {
 #ifdef HAVE_COMPOSITE_EXTENSIONS
+  MetaCompositorXRender *xrc = (MetaCompositorXRender *) compositor;
+
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Damage: %u events received, %u regions processed\n",
+              xrc->damage_events, xrc->damage_regions);
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Paint: %u paints, %" G_GINT64_FORMAT " us total, "
+              "%" G_GINT64_FORMAT " us max, %" G_GUINT64_FORMAT
+              " pixels damaged, %u pictures created\n", xrc->paints,
+              xrc->paint_time_total, xrc->paint_time_max,
+              xrc->damaged_pixels, xrc->pictures_created);
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Composited %" G_GUINT64_FORMAT " bytes, at most %"
+              G_GUINT64_FORMAT " in a frame\n", xrc->bytes_composited,
+              xrc->bytes_composited_max);
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Uploads: %u through shared memory, %u over the connection\n",
+              xrc->uploads_shm, xrc->uploads_socket);
+
+  if (xrc->trace)
+    fclose (xrc->trace);
+
+#ifdef HAVE_XSHM
+  while (xrc->shm_segments)
+    {
+      shm_segment_free (xrc->display, xrc->shm_segments->data);
+      xrc->shm_segments = g_slist_delete_link (xrc->shm_segments,
+                                               xrc->shm_segments);
+    }
+#endif
+
+#ifdef USE_IDLE_REPAINT
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Frame clock: %u frames painted, %u repaints coalesced, "
+              "%u frames dropped\n", xrc->frames_painted,
+              xrc->frames_coalesced, xrc->frames_dropped);
+
+  if (xrc->repaint_id > 0)
+    g_source_remove (xrc->repaint_id);
+#endif
+
   g_free (compositor);
 #endif
 }
@@ -2901,6 +4773,162 @@ xrender_get_window_pixmap (MetaCompositor *compositor,
 #endif
 }
 
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+/* Scales the window picture down into the thumbnail pixmap.  The
+   picture is shared with painting, so its transform and filter are
+   put back once done. */
+static gboolean
+render_thumbnail (MetaCompWindow *cw,
+                  int             width,
+                  int             height)
+{
+  MetaDisplay *display = meta_screen_get_display (cw->screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  Window xroot = meta_screen_get_xroot (cw->screen);
+  XRenderPictFormat *format;
+  XTransform transform = {{
+    { XDoubleToFixed (1), 0, 0 },
+    { 0, XDoubleToFixed (1), 0 },
+    { 0, 0, XDoubleToFixed (1) }
+  }};
+  XFixed *params;
+  Picture thumbnail;
+  double sx, sy;
+  int kw, kh, i;
+
+  if (cw->picture == None)
+    cw->picture = get_window_picture (cw);
+  if (cw->picture == None)
+    return FALSE;
+
+  format = XRenderFindStandardFormat (xdisplay, PictStandardARGB32);
+
+  if (cw->thumbnail_pixmap != None &&
+      (cw->thumbnail_width != width || cw->thumbnail_height != height))
+    {
+      XFreePixmap (xdisplay, cw->thumbnail_pixmap);
+      cw->thumbnail_pixmap = None;
+    }
+
+  if (cw->thumbnail_pixmap == None)
+    {
+      cw->thumbnail_pixmap = XCreatePixmap (xdisplay, xroot, width, height, 32);
+      cw->thumbnail_width = width;
+      cw->thumbnail_height = height;
+    }
+
+  thumbnail = XRenderCreatePicture (xdisplay, cw->thumbnail_pixmap, format,
+                                    0, NULL);
+
+  sx = (double) (cw->attrs.width + cw->attrs.border_width * 2) / width;
+  sy = (double) (cw->attrs.height + cw->attrs.border_width * 2) / height;
+
+  /* A box filter the size of a thumbnail pixel in the source, so that
+     every source pixel counts for something */
+  kw = CLAMP ((int) ceil (sx), 1, THUMBNAIL_FILTER_MAX);
+  kh = CLAMP ((int) ceil (sy), 1, THUMBNAIL_FILTER_MAX);
+  params = g_new (XFixed, kw * kh + 2);
+  params[0] = XDoubleToFixed (kw);
+  params[1] = XDoubleToFixed (kh);
+  for (i = 0; i < kw * kh; i++)
+    params[i + 2] = XDoubleToFixed (1.0 / (kw * kh));
+
+  transform.matrix[0][0] = XDoubleToFixed (sx);
+  transform.matrix[1][1] = XDoubleToFixed (sy);
+  XRenderSetPictureTransform (xdisplay, cw->picture, &transform);
+  if (kw * kh > 1)
+    XRenderSetPictureFilter (xdisplay, cw->picture, FilterConvolution,
+                             params, kw * kh + 2);
+  else
+    XRenderSetPictureFilter (xdisplay, cw->picture, FilterGood, NULL, 0);
+
+  XRenderComposite (xdisplay, PictOpSrc, cw->picture, None, thumbnail,
+                    0, 0, 0, 0, 0, 0, width, height);
+
+  transform.matrix[0][0] = XDoubleToFixed (1);
+  transform.matrix[1][1] = XDoubleToFixed (1);
+  XRenderSetPictureTransform (xdisplay, cw->picture, &transform);
+  XRenderSetPictureFilter (xdisplay, cw->picture, FilterNearest, NULL, 0);
+
+  XRenderFreePicture (xdisplay, thumbnail);
+  g_free (params);
+
+  return TRUE;
+}
+#endif
+
+/* Returns a 32 bit pixmap holding the window scaled down to fit in
+   max_width by max_height, or None.  The pixmap belongs to the
+   compositor and stays valid until the window is destroyed or asked
+   for at another size; it is only redrawn when the window has been
+   damaged since the last call. */
+static Pixmap
+xrender_get_window_thumbnail (MetaCompositor *compositor,
+                              MetaWindow     *window,
+                              int             max_width,
+                              int             max_height,
+                              int            *width,
+                              int            *height)
+{
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+  MetaScreen *screen = meta_window_get_screen (window);
+  MetaDisplay *display = meta_window_get_display (window);
+  MetaFrame *frame = meta_window_get_frame (window);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaCompWindow *cw;
+  double scale;
+  int w, h, tw, th;
+  gboolean rendered;
+
+  cw = find_window_for_screen (screen, frame ? meta_frame_get_xwindow (frame) :
+                               meta_window_get_xwindow (window));
+  if (cw == NULL || info == NULL || cw->attrs.class == InputOnly ||
+      max_width <= 0 || max_height <= 0)
+    return None;
+
+  w = cw->attrs.width + cw->attrs.border_width * 2;
+  h = cw->attrs.height + cw->attrs.border_width * 2;
+
+  scale = MIN (1.0, MIN ((double) max_width / w, (double) max_height / h));
+  tw = MAX ((int) (w * scale), 1);
+  th = MAX ((int) (h * scale), 1);
+
+  /* Keep the last thumbnail of windows that cannot be read back: the
+     unmapped and the one painting straight to the screen */
+  if (cw->thumbnail_pixmap != None &&
+      cw->thumbnail_width == tw && cw->thumbnail_height == th &&
+      (!cw->thumbnail_stale || cw == info->unredirected ||
+       cw->attrs.map_state != IsViewable))
+    {
+      info->thumbnails_reused++;
+    }
+  else
+    {
+      if (cw == info->unredirected || cw->attrs.map_state != IsViewable)
+        return None;
+
+      meta_error_trap_push (display);
+      rendered = render_thumbnail (cw, tw, th);
+      meta_error_trap_pop (display, FALSE);
+
+      if (!rendered)
+        return None;
+
+      cw->thumbnail_stale = FALSE;
+      info->thumbnails_rendered++;
+    }
+
+  if (width)
+    *width = cw->thumbnail_width;
+  if (height)
+    *height = cw->thumbnail_height;
+
+  return cw->thumbnail_pixmap;
+#else
+  return None;
+#endif
+}
+
 static void
 xrender_set_active_window (MetaCompositor *compositor,
                            MetaScreen     *screen,
@@ -2959,11 +4987,7 @@ xrender_set_active_window (MetaCompositor *compositor,
 
       if (old_focus->attrs.map_state == IsViewable)
         {
-          if (old_focus->shadow)
-            {
-              XRenderFreePicture (xdisplay, old_focus->shadow);
-              old_focus->shadow = None;
-            }
+          retire_shadow (old_focus);
           
           if (old_focus->extents)
             {
@@ -3003,11 +5027,7 @@ xrender_set_active_window (MetaCompositor *compositor,
       determine_mode (display, screen, new_focus);
       new_focus->needs_shadow = window_has_shadow (new_focus);
       
-      if (new_focus->shadow)
-        {
-          XRenderFreePicture (xdisplay, new_focus->shadow);
-          new_focus->shadow = None;
-        }
+      retire_shadow (new_focus);
       
       if (new_focus->extents)
         {
@@ -3038,8 +5058,130 @@ xrender_set_active_window (MetaCompositor *compositor,
         }
     }
 #ifdef USE_IDLE_REPAINT
-  add_repair (display);
+  schedule_repaint (display, TRUE);
+#endif
+#endif
+}
+
+/* Writes the statistics gathered so far to the
+   _METACITY_COMPOSITOR_STATS property of every composited root
+   window, as "name value" lines */
+static void
+xrender_publish_stats (MetaCompositor *compositor)
+{
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+  MetaCompositorXRender *xrc = (MetaCompositorXRender *) compositor;
+  Display *xdisplay = meta_display_get_xdisplay (xrc->display);
+  GSList *screens;
+  GString *stats;
+  int i;
+
+  /* Damaged pixels are counted from the first request on */
+  xrc->count_damaged_pixels = TRUE;
+
+  stats = g_string_new (NULL);
+
+#ifdef USE_IDLE_REPAINT
+  g_string_append_printf (stats, "frame-interval-us %" G_GINT64_FORMAT "\n",
+                          xrc->frame_interval);
+  g_string_append_printf (stats, "frames-painted %u\n", xrc->frames_painted);
+  g_string_append_printf (stats, "frames-coalesced %u\n",
+                          xrc->frames_coalesced);
+  g_string_append_printf (stats, "frames-dropped %u\n", xrc->frames_dropped);
 #endif
+
+  g_string_append_printf (stats, "paints %u\n", xrc->paints);
+  g_string_append_printf (stats, "paint-time-total-us %" G_GINT64_FORMAT "\n",
+                          xrc->paint_time_total);
+  g_string_append_printf (stats, "paint-time-max-us %" G_GINT64_FORMAT "\n",
+                          xrc->paint_time_max);
+  for (i = 0; i < PAINT_TIME_BUCKETS - 1; i++)
+    g_string_append_printf (stats, "paint-time-under-%dms %u\n",
+                            1 << i, xrc->paint_time_histogram[i]);
+  g_string_append_printf (stats, "paint-time-over-%dms %u\n",
+                          1 << (PAINT_TIME_BUCKETS - 2),
+                          xrc->paint_time_histogram[PAINT_TIME_BUCKETS - 1]);
+
+  g_string_append_printf (stats, "damage-events %u\n", xrc->damage_events);
+  g_string_append_printf (stats, "damage-regions %u\n", xrc->damage_regions);
+  g_string_append_printf (stats, "damaged-pixels %" G_GUINT64_FORMAT "\n",
+                          xrc->damaged_pixels);
+  g_string_append_printf (stats, "pictures-created %u\n",
+                          xrc->pictures_created);
+  g_string_append_printf (stats, "bytes-composited %" G_GUINT64_FORMAT "\n",
+                          xrc->bytes_composited);
+  g_string_append_printf (stats, "bytes-composited-last-frame %"
+                          G_GUINT64_FORMAT "\n", xrc->bytes_composited_last);
+  g_string_append_printf (stats, "bytes-composited-max-frame %"
+                          G_GUINT64_FORMAT "\n", xrc->bytes_composited_max);
+  g_string_append_printf (stats, "uploads-shm %u\n", xrc->uploads_shm);
+  g_string_append_printf (stats, "uploads-socket %u\n", xrc->uploads_socket);
+
+  for (screens = meta_display_get_screens (xrc->display);
+       screens; screens = screens->next)
+    {
+      MetaScreen *screen = screens->data;
+      MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+      int n = meta_screen_get_screen_number (screen);
+
+      if (info == NULL)
+        continue;
+
+      g_string_append_printf (stats, "screen-%d-windows-painted %u\n",
+                              n, info->total_windows_painted);
+      g_string_append_printf (stats, "screen-%d-windows-culled %u\n",
+                              n, info->total_windows_culled);
+      g_string_append_printf (stats, "screen-%d-windows-undamaged %u\n",
+                              n, info->total_windows_undamaged);
+      g_string_append_printf (stats, "screen-%d-root-tile-version %u\n",
+                              n, info->root_tile_version);
+      g_string_append_printf (stats, "screen-%d-frames-full %u\n",
+                              n, info->frames_full);
+      g_string_append_printf (stats, "screen-%d-frames-partial %u\n",
+                              n, info->frames_partial);
+      g_string_append_printf (stats, "screen-%d-shadow-cache-hits %u\n",
+                              n, info->shadow_cache_hits);
+      g_string_append_printf (stats, "screen-%d-shadow-cache-misses %u\n",
+                              n, info->shadow_cache_misses);
+      g_string_append_printf (stats, "screen-%d-shadow-cache-bytes %lu\n",
+                              n, (gulong) info->shadow_cache_size);
+      g_string_append_printf (stats, "screen-%d-shadow-jobs-queued %u\n",
+                              n, info->shadow_jobs_queued);
+      g_string_append_printf (stats, "screen-%d-shadow-jobs-cancelled %u\n",
+                              n, info->shadow_jobs_cancelled);
+      g_string_append_printf (stats, "screen-%d-unredirected %d\n",
+                              n, info->unredirected != NULL);
+      g_string_append_printf (stats, "screen-%d-pictures-kept %u\n",
+                              n, g_queue_get_length (info->kept_pictures));
+      g_string_append_printf (stats, "screen-%d-pictures-reused %u\n",
+                              n, info->pictures_reused);
+      g_string_append_printf (stats, "screen-%d-pictures-evicted %u\n",
+                              n, info->pictures_evicted);
+      g_string_append_printf (stats, "screen-%d-thumbnails-rendered %u\n",
+                              n, info->thumbnails_rendered);
+      g_string_append_printf (stats, "screen-%d-thumbnails-reused %u\n",
+                              n, info->thumbnails_reused);
+      g_string_append_printf (stats, "screen-%d-fades-started %u\n",
+                              n, info->fades_started);
+      g_string_append_printf (stats, "screen-%d-fades-active %u\n",
+                              n, g_slist_length (info->fading_windows));
+    }
+
+  for (screens = meta_display_get_screens (xrc->display);
+       screens; screens = screens->next)
+    {
+      MetaScreen *screen = screens->data;
+
+      if (meta_screen_get_compositor_data (screen) == NULL)
+        continue;
+
+      XChangeProperty (xdisplay, meta_screen_get_xroot (screen),
+                       xrc->atom_metacity_compositor_stats,
+                       xrc->atom_utf8_string, 8, PropModeReplace,
+                       (guchar *) stats->str, stats->len);
+    }
+
+  g_string_free (stats, TRUE);
 #endif
 }
 
@@ -3052,7 +5194,9 @@ static MetaCompositor comp_info = {
   xrender_set_updates,
   xrender_process_event,
   xrender_get_window_pixmap,
-  xrender_set_active_window
+  xrender_set_active_window,
+  xrender_publish_stats,
+  xrender_get_window_thumbnail
 };
 
 MetaCompositor *
@@ -3076,6 +5220,8 @@ meta_compositor_xrender_new (MetaDisplay *display)
     "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU",
     "_NET_WM_WINDOW_TYPE_TOOLTIP",
     "_METACITY_WINDOW_HAVE_SHADOW",
+    "_METACITY_COMPOSITOR_STATS",
+    "UTF8_STRING",
   };
   Atom atoms[G_N_ELEMENTS(atom_names)];
   MetaCompositorXRender *xrc;
@@ -3111,13 +5257,85 @@ meta_compositor_xrender_new (MetaDisplay *display)
   xrc->atom_net_wm_window_type_tooltip = atoms[14];
 
   xrc->atom_metacity_window_have_shadow = atoms[15];
+  xrc->atom_metacity_compositor_stats = atoms[16];
+  xrc->atom_utf8_string = atoms[17];
 
   xrc->show_redraw = FALSE;
   xrc->debug = FALSE;
+  xrc->damage_events = 0;
+  xrc->damage_regions = 0;
+
+  xrc->paints = 0;
+  memset (xrc->paint_time_histogram, 0, sizeof (xrc->paint_time_histogram));
+  xrc->paint_time_total = 0;
+  xrc->paint_time_max = 0;
+  xrc->damaged_pixels = 0;
+  xrc->pictures_created = 0;
+  xrc->count_damaged_pixels = FALSE;
+  xrc->bytes_composited = 0;
+  xrc->bytes_composited_last = 0;
+  xrc->bytes_composited_max = 0;
+  xrc->uploads_shm = 0;
+  xrc->uploads_socket = 0;
+
+  xrc->trace = NULL;
+  xrc->trace_time = 0;
+  if (g_getenv ("METACITY_COMPOSITOR_RECORD"))
+    {
+      const char *path = g_getenv ("METACITY_COMPOSITOR_RECORD");
+
+      xrc->trace = fopen (path, "w");
+      if (xrc->trace == NULL)
+        meta_warning ("Cannot record compositor trace to %s: %s\n",
+                      path, g_strerror (errno));
+      else
+        {
+          /* Programs we launch have no business writing to it */
+          fcntl (fileno (xrc->trace), F_SETFD,
+                 fcntl (fileno (xrc->trace), F_GETFD, 0) | FD_CLOEXEC);
+          fputs ("# metacity compositor trace 1\n", xrc->trace);
+        }
+    }
+
+#ifdef HAVE_XSHM
+  xrc->have_shm = XShmQueryExtension (xdisplay) &&
+    g_getenv ("META_DEBUG_NO_SHM") == NULL;
+  xrc->shm_segments = NULL;
+  meta_verbose ("%s MIT-SHM for image uploads\n",
+                xrc->have_shm ? "Using" : "Not using");
+#endif
+
+  xrc->fade_time = 0;
 
 #ifdef USE_IDLE_REPAINT
   meta_verbose ("Using idle repaint\n");
   xrc->repaint_id = 0;
+
+  {
+    const char *fade_env = g_getenv ("METACITY_COMPOSITOR_FADE_TIME");
+    int fade_time = DEFAULT_FADE_TIME;
+
+    if (fade_env != NULL)
+      fade_time = CLAMP (atoi (fade_env), 0, MAX_FADE_TIME);
+
+    xrc->fade_time = (gint64) fade_time * 1000;
+  }
+
+  {
+    const char *fps_env = g_getenv ("METACITY_COMPOSITOR_FPS");
+    int fps = DEFAULT_FRAME_RATE;
+
+    if (fps_env != NULL)
+      fps = CLAMP (atoi (fps_env), 0, MAX_FRAME_RATE);
+
+    xrc->frame_interval = fps > 0 ? G_USEC_PER_SEC / fps : 0;
+    meta_verbose ("Frame clock running at %d fps\n", fps);
+  }
+  xrc->frame_deadline = 0;
+  xrc->last_frame_time = 0;
+  xrc->frames_painted = 0;
+  xrc->frames_coalesced = 0;
+  xrc->frames_dropped = 0;
 #endif
 
   xrc->enabled = TRUE;
@@ -130,6 +130,35 @@ meta_compositor_set_active_window (MetaCompositor *compositor,
 #endif
 }
 
+void
+meta_compositor_publish_stats (MetaCompositor *compositor)
+{
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+  if (compositor && compositor->publish_stats)
+    compositor->publish_stats (compositor);
+#endif
+}
+
+Pixmap
+meta_compositor_get_window_thumbnail (MetaCompositor *compositor,
+                                      MetaWindow     *window,
+                                      int             max_width,
+                                      int             max_height,
+                                      int            *width,
+                                      int            *height)
+{
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+  if (compositor && compositor->get_window_thumbnail)
+    return compositor->get_window_thumbnail (compositor, window,
+                                             max_width, max_height,
+                                             width, height);
+  else
+    return None;
+#else
+  return None;
+#endif
+}
+
 /* These functions are unused at the moment */
 void meta_compositor_begin_move (MetaCompositor *compositor,
                                  MetaWindow     *window,
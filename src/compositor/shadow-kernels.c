@@ -0,0 +1,603 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Metacity shadow rasterisation */
+
+/*
+ * Based on xcompmgr - (c) 2003 Keith Packard
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "shadow-kernels.h"
+
+#if defined (__GNUC__) && (defined (__i386__) || defined (__x86_64__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+/* Fixed point value of a whole gaussian map */
+#define GAUSSIAN_ONE (1 << 16)
+
+/* The opaque level of the presummed tables */
+#define OPAQUE_LEVEL (SHADOW_OPACITY_LEVELS - 1)
+
+/* The two operations the tables are built from: scaling a row of
+   opaque shadow values down to an opacity level, and copying a row
+   mirrored for the right hand side of the shadow */
+typedef struct
+{
+  void (* scale)   (guchar       *dest,
+                    const guchar *src,
+                    int           n,
+                    int           level);
+  void (* reverse) (guchar       *dest,
+                    const guchar *src,
+                    int           n);
+} ShadowKernelFuncs;
+
+static void
+scale_scalar (guchar       *dest,
+              const guchar *src,
+              int           n,
+              int           level)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    dest[i] = src[i] * level / OPAQUE_LEVEL;
+}
+
+static void
+reverse_scalar (guchar       *dest,
+                const guchar *src,
+                int           n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    dest[i] = src[n - i - 1];
+}
+
+#ifdef HAVE_X86_KERNELS
+/* v * level / 25 is exactly (v * level * 5243) >> 17 for every value
+   a table can hold, which keeps the vector kernels bit for bit equal
+   to the scalar one */
+#define DIV25_MAGIC 5243
+
+__attribute__ ((target ("sse2")))
+static void
+scale_sse2 (guchar       *dest,
+            const guchar *src,
+            int           n,
+            int           level)
+{
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i factor = _mm_set1_epi16 (level);
+  __m128i magic = _mm_set1_epi16 (DIV25_MAGIC);
+  int i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+      __m128i lo = _mm_unpacklo_epi8 (v, zero);
+      __m128i hi = _mm_unpackhi_epi8 (v, zero);
+
+      lo = _mm_srli_epi16 (_mm_mulhi_epu16 (_mm_mullo_epi16 (lo, factor),
+                                            magic), 1);
+      hi = _mm_srli_epi16 (_mm_mulhi_epu16 (_mm_mullo_epi16 (hi, factor),
+                                            magic), 1);
+
+      _mm_storeu_si128 ((__m128i *) (dest + i), _mm_packus_epi16 (lo, hi));
+    }
+
+  scale_scalar (dest + i, src + i, n - i, level);
+}
+
+__attribute__ ((target ("sse2")))
+static void
+reverse_sse2 (guchar       *dest,
+              const guchar *src,
+              int           n)
+{
+  int i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (src + n - i - 16));
+
+      /* Swap the bytes of each word, then the words, then the halves */
+      v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+      v = _mm_shufflelo_epi16 (v, _MM_SHUFFLE (0, 1, 2, 3));
+      v = _mm_shufflehi_epi16 (v, _MM_SHUFFLE (0, 1, 2, 3));
+      v = _mm_shuffle_epi32 (v, _MM_SHUFFLE (1, 0, 3, 2));
+
+      _mm_storeu_si128 ((__m128i *) (dest + i), v);
+    }
+
+  reverse_scalar (dest + i, src, n - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+scale_avx2 (guchar       *dest,
+            const guchar *src,
+            int           n,
+            int           level)
+{
+  __m256i zero = _mm256_setzero_si256 ();
+  __m256i factor = _mm256_set1_epi16 (level);
+  __m256i magic = _mm256_set1_epi16 (DIV25_MAGIC);
+  int i;
+
+  /* Unpacking and packing both work within 128 bit lanes, so the
+     bytes come back out in the order they went in */
+  for (i = 0; i + 32 <= n; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i));
+      __m256i lo = _mm256_unpacklo_epi8 (v, zero);
+      __m256i hi = _mm256_unpackhi_epi8 (v, zero);
+
+      lo = _mm256_srli_epi16 (_mm256_mulhi_epu16 (_mm256_mullo_epi16 (lo, factor),
+                                                  magic), 1);
+      hi = _mm256_srli_epi16 (_mm256_mulhi_epu16 (_mm256_mullo_epi16 (hi, factor),
+                                                  magic), 1);
+
+      _mm256_storeu_si256 ((__m256i *) (dest + i),
+                           _mm256_packus_epi16 (lo, hi));
+    }
+
+  scale_scalar (dest + i, src + i, n - i, level);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+reverse_avx2 (guchar       *dest,
+              const guchar *src,
+              int           n)
+{
+  __m256i mask = _mm256_setr_epi8 (15, 14, 13, 12, 11, 10, 9, 8,
+                                   7, 6, 5, 4, 3, 2, 1, 0,
+                                   15, 14, 13, 12, 11, 10, 9, 8,
+                                   7, 6, 5, 4, 3, 2, 1, 0);
+  int i;
+
+  for (i = 0; i + 32 <= n; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + n - i - 32));
+
+      /* Reverse each lane, then swap the lanes */
+      v = _mm256_shuffle_epi8 (v, mask);
+      v = _mm256_permute2x128_si256 (v, v, 0x01);
+
+      _mm256_storeu_si256 ((__m256i *) (dest + i), v);
+    }
+
+  reverse_scalar (dest + i, src, n - i);
+}
+#endif
+
+static const ShadowKernelFuncs kernel_funcs[META_SHADOW_KERNEL_LAST] = {
+  { scale_scalar, reverse_scalar },
+#ifdef HAVE_X86_KERNELS
+  { scale_sse2, reverse_sse2 },
+  { scale_avx2, reverse_avx2 },
+#else
+  { NULL, NULL },
+  { NULL, NULL },
+#endif
+};
+
+static const char *kernel_names[META_SHADOW_KERNEL_LAST] = {
+  "scalar",
+  "sse2",
+  "avx2"
+};
+
+static const ShadowKernelFuncs *kernels = NULL;
+static MetaShadowKernel current_kernel;
+
+gboolean
+meta_shadow_kernel_supported (MetaShadowKernel kernel)
+{
+  switch (kernel)
+    {
+    case META_SHADOW_KERNEL_SCALAR:
+      return TRUE;
+#ifdef HAVE_X86_KERNELS
+    case META_SHADOW_KERNEL_SSE2:
+      return __builtin_cpu_supports ("sse2");
+    case META_SHADOW_KERNEL_AVX2:
+      return __builtin_cpu_supports ("avx2");
+#endif
+    default:
+      return FALSE;
+    }
+}
+
+void
+meta_shadow_set_kernel (MetaShadowKernel kernel)
+{
+  g_return_if_fail (meta_shadow_kernel_supported (kernel));
+
+  current_kernel = kernel;
+  kernels = &kernel_funcs[kernel];
+}
+
+MetaShadowKernel
+meta_shadow_get_kernel (void)
+{
+  if (kernels == NULL)
+    {
+      const char *name = g_getenv ("METACITY_SHADOW_KERNEL");
+      int i;
+
+      for (i = META_SHADOW_KERNEL_LAST - 1; i > 0; i--)
+        if (meta_shadow_kernel_supported (i) &&
+            (name == NULL || strcmp (name, kernel_names[i]) == 0))
+          break;
+
+      meta_shadow_set_kernel (i);
+    }
+
+  return current_kernel;
+}
+
+const char *
+meta_shadow_kernel_name (MetaShadowKernel kernel)
+{
+  g_return_val_if_fail (kernel < META_SHADOW_KERNEL_LAST, NULL);
+
+  return kernel_names[kernel];
+}
+
+/* Gaussian stuff for creating the shadows */
+static double
+gaussian (double r,
+          double x,
+          double y)
+{
+  return ((1 / (sqrt (2 * G_PI * r))) *
+          exp ((- (x * x + y * y)) / (2 * r * r)));
+}
+
+conv *
+meta_shadow_make_gaussian_map (double r)
+{
+  conv *c;
+  int size, centre;
+  int x, y;
+  double t, g;
+  double *sums;
+
+  size = ((int) ceil ((r * 3)) + 1) & ~1;
+  centre = size / 2;
+  c = g_malloc (sizeof (conv) + size * size * sizeof (double) +
+                (size + 1) * (size + 1) * sizeof (guint32));
+  c->size = size;
+  c->data = (double *) (c + 1);
+  c->sums = (guint32 *) (c->data + size * size);
+  t = 0.0;
+
+  for (y = 0; y < size; y++)
+    {
+      for (x = 0; x < size; x++)
+        {
+          g = gaussian (r, (double) (x - centre), (double) (y - centre));
+          t += g;
+          c->data[y * size + x] = g;
+        }
+    }
+
+  for (y = 0; y < size; y++)
+    {
+      for (x = 0; x < size; x++)
+        {
+          c->data[y * size + x] /= t;
+        }
+    }
+
+  /* The running sums are kept in double precision and only rounded
+     as they are stored, so no error accumulates across the table */
+  sums = g_new0 (double, size + 1);
+
+  for (y = 0; y <= size; y++)
+    {
+      double row = 0.0;
+
+      for (x = 0; x <= size; x++)
+        {
+          if (y > 0 && x > 0)
+            {
+              row += c->data[(y - 1) * size + (x - 1)];
+              sums[x] += row;
+            }
+
+          c->sums[y * (size + 1) + x] =
+            (guint32) (sums[x] * GAUSSIAN_ONE + 0.5);
+        }
+    }
+
+  g_free (sums);
+
+  return c;
+}
+
+/*
+* A picture will help
+*
+*      -center   0                width  width+center
+*  -center +-----+-------------------+-----+
+*          |     |                   |     |
+*          |     |                   |     |
+*        0 +-----+-------------------+-----+
+*          |     |                   |     |
+*          |     |                   |     |
+*          |     |                   |     |
+*   height +-----+-------------------+-----+
+*          |     |                   |     |
+* height+  |     |                   |     |
+*  center  +-----+-------------------+-----+
+*/
+guchar
+meta_shadow_sum_gaussian (conv   *map,
+                          double  opacity,
+                          int     x,
+                          int     y,
+                          int     width,
+                          int     height)
+{
+  guint32 *sums;
+  gint64 v;
+  guint32 scale;
+  int fx_start, fx_end;
+  int fy_start, fy_end;
+  int g_size, centre, stride;
+
+  sums = map->sums;
+  g_size = map->size;
+  stride = g_size + 1;
+  centre = g_size / 2;
+  fx_start = centre - x;
+  if (fx_start < 0)
+    fx_start = 0;
+
+  fx_end = width + centre - x;
+  if (fx_end > g_size)
+    fx_end = g_size;
+
+  fy_start = centre - y;
+  if (fy_start < 0)
+    fy_start = 0;
+
+  fy_end = height + centre - y;
+  if (fy_end > g_size)
+    fy_end = g_size;
+
+  if (fx_end <= fx_start || fy_end <= fy_start)
+    return 0;
+
+  v = (gint64) sums[fy_end * stride + fx_end]
+    - sums[fy_start * stride + fx_end]
+    - sums[fy_end * stride + fx_start]
+    + sums[fy_start * stride + fx_start];
+  v = CLAMP (v, 0, GAUSSIAN_ONE);
+
+  /* Opacity times 255 in 24.8 fixed point */
+  scale = (guint32) (CLAMP (opacity, 0.0, 1.0) * 255.0 * 256.0);
+
+  return (guchar) (((guint64) v * scale) >> 24);
+}
+
+/* precompute shadow corners and sides to save time for large windows */
+void
+meta_shadow_presum (conv    *map,
+                    guchar **corner,
+                    guchar **top)
+{
+  int centre;
+  int level, x, y;
+  int msize;
+  guchar *opaque_corner, *opaque_top;
+
+  msize = map->size;
+  centre = map->size / 2;
+
+  meta_shadow_get_kernel ();
+
+  *corner = g_malloc ((msize + 1) * (msize + 1) * SHADOW_OPACITY_LEVELS);
+  *top = g_malloc ((msize + 1) * SHADOW_OPACITY_LEVELS);
+
+  opaque_corner = *corner + OPAQUE_LEVEL * (msize + 1) * (msize + 1);
+  opaque_top = *top + OPAQUE_LEVEL * (msize + 1);
+
+  for (x = 0; x <= msize; x++)
+    {
+      opaque_top[x] = meta_shadow_sum_gaussian (map, 1, x - centre, centre,
+                                                msize * 2, msize * 2);
+
+      for (y = 0; y <= x; y++)
+        {
+          opaque_corner[y * (msize + 1) + x] =
+            meta_shadow_sum_gaussian (map, 1, x - centre, y - centre,
+                                      msize * 2, msize * 2);
+          opaque_corner[x * (msize + 1) + y] =
+            opaque_corner[y * (msize + 1) + x];
+        }
+    }
+
+  for (level = 0; level < OPAQUE_LEVEL; level++)
+    {
+      kernels->scale (*corner + level * (msize + 1) * (msize + 1),
+                      opaque_corner, (msize + 1) * (msize + 1), level);
+      kernels->scale (*top + level * (msize + 1), opaque_top,
+                      msize + 1, level);
+    }
+}
+
+/* The general case, for windows smaller than the gaussian map */
+static void
+fill_small (conv         *map,
+            const guchar *corner,
+            const guchar *top,
+            double        opacity,
+            int           width,
+            int           height,
+            int           xlimit,
+            int           ylimit,
+            guchar       *data)
+{
+  int msize = map->size;
+  int centre = msize / 2;
+  int swidth = width + msize;
+  int sheight = height + msize;
+  int level = (int) (opacity * OPAQUE_LEVEL);
+  int x, y, x_diff;
+  guchar d;
+
+  /*
+   * corners
+   */
+  for (y = 0; y < ylimit; y++)
+    {
+      for (x = 0; x < xlimit; x++)
+        {
+          d = meta_shadow_sum_gaussian (map, opacity, x - centre,
+                                        y - centre, width, height);
+
+          data[y * swidth + x] = d;
+          data[(sheight - y - 1) * swidth + x] = d;
+          data[(sheight - y - 1) * swidth + (swidth - x - 1)] = d;
+          data[y * swidth + (swidth - x - 1)] = d;
+        }
+    }
+
+  /* top/bottom */
+  x_diff = swidth - (msize * 2);
+  if (x_diff > 0 && ylimit > 0)
+    {
+      for (y = 0; y < ylimit; y++)
+        {
+          if (ylimit == msize)
+            d = top[level * (msize + 1) + y];
+          else
+            d = meta_shadow_sum_gaussian (map, opacity, centre,
+                                          y - centre, width, height);
+
+          memset (&data[y * swidth + msize], d, x_diff);
+          memset (&data[(sheight - y - 1) * swidth + msize], d, x_diff);
+        }
+    }
+
+  /*
+   * sides
+   */
+  for (x = 0; x < xlimit; x++)
+    {
+      if (xlimit == msize)
+        d = top[level * (msize + 1) + x];
+      else
+        d = meta_shadow_sum_gaussian (map, opacity, x - centre,
+                                      centre, width, height);
+
+      for (y = msize; y < sheight - msize; y++)
+        {
+          data[y * swidth + x] = d;
+          data[y * swidth + (swidth - x - 1)] = d;
+        }
+    }
+}
+
+void
+meta_shadow_fill (conv         *map,
+                  const guchar *corner,
+                  const guchar *top,
+                  double        opacity,
+                  int           width,
+                  int           height,
+                  guchar       *data)
+{
+  int msize = map->size;
+  int centre = msize / 2;
+  int swidth = width + msize;
+  int sheight = height + msize;
+  int level = (int) (opacity * OPAQUE_LEVEL);
+  int xlimit, ylimit, x_diff, y;
+  const guchar *side;
+  guchar *side_right;
+  guchar d;
+
+  meta_shadow_get_kernel ();
+
+  /*
+   * centre (fill the complete data array
+   */
+  if (msize > 0)
+    d = top[level * (msize + 1) + msize];
+  else
+    d = meta_shadow_sum_gaussian (map, opacity, centre,
+                                  centre, width, height);
+  memset (data, d, sheight * swidth);
+
+  ylimit = msize;
+  if (ylimit > sheight / 2)
+    ylimit = (sheight + 1) / 2;
+
+  xlimit = msize;
+  if (xlimit > swidth / 2)
+    xlimit = (swidth + 1) / 2;
+
+  if (xlimit != msize || ylimit != msize)
+    {
+      fill_small (map, corner, top, opacity, width, height,
+                  xlimit, ylimit, data);
+      return;
+    }
+
+  /* The window is at least as big as the map, so every shadow row is
+     made of rows of the presummed tables and their mirror images */
+  x_diff = swidth - (msize * 2);
+
+  for (y = 0; y < msize; y++)
+    {
+      const guchar *corner_row;
+      guchar *row, *bottom_row;
+
+      corner_row = corner + level * (msize + 1) * (msize + 1) + y * (msize + 1);
+      row = data + y * swidth;
+      bottom_row = data + (sheight - y - 1) * swidth;
+
+      memcpy (row, corner_row, msize);
+      if (x_diff > 0)
+        memset (row + msize, top[level * (msize + 1) + y], x_diff);
+      kernels->reverse (row + swidth - msize, corner_row, msize);
+
+      if (bottom_row != row)
+        memcpy (bottom_row, row, swidth);
+    }
+
+  side = top + level * (msize + 1);
+  side_right = g_alloca (msize);
+  kernels->reverse (side_right, side, msize);
+
+  for (y = msize; y < sheight - msize; y++)
+    {
+      memcpy (data + y * swidth, side, msize);
+      memcpy (data + y * swidth + swidth - msize, side_right, msize);
+    }
+}
@@ -0,0 +1,82 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Metacity shadow rasterisation */
+
+/*
+ * Based on xcompmgr - (c) 2003 Keith Packard
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef META_SHADOW_KERNELS_H_
+#define META_SHADOW_KERNELS_H_
+
+#include <glib.h>
+
+/* A normalised gaussian convolution map.  sums is a summed area
+   table of it in 16.16 fixed point, (size + 1) entries square, so
+   that summing any rectangle of the map takes four lookups. */
+typedef struct _conv
+{
+  int size;
+  double *data;
+  guint32 *sums;
+} conv;
+
+/* The presummed shadow tables come in this many opacity levels,
+   from transparent to opaque */
+#define SHADOW_OPACITY_LEVELS 26
+
+typedef enum
+{
+  META_SHADOW_KERNEL_SCALAR,
+  META_SHADOW_KERNEL_SSE2,
+  META_SHADOW_KERNEL_AVX2,
+  META_SHADOW_KERNEL_LAST
+} MetaShadowKernel;
+
+/* Freed with g_free () */
+conv  *meta_shadow_make_gaussian_map (double r);
+
+guchar meta_shadow_sum_gaussian (conv   *map,
+                                 double  opacity,
+                                 int     x,
+                                 int     y,
+                                 int     width,
+                                 int     height);
+
+/* Precomputes the shadow corner and side tables for every opacity
+   level.  The tables are freed with g_free (). */
+void   meta_shadow_presum (conv    *map,
+                           guchar **corner,
+                           guchar **top);
+
+/* Fills data, (width + map->size) by (height + map->size) pixels,
+   with the shadow of a width by height window */
+void   meta_shadow_fill (conv         *map,
+                         const guchar *corner,
+                         const guchar *top,
+                         double        opacity,
+                         int           width,
+                         int           height,
+                         guchar       *data);
+
+/* The kernels are picked at the first use, as the best the CPU
+   supports unless METACITY_SHADOW_KERNEL names another one */
+gboolean         meta_shadow_kernel_supported (MetaShadowKernel kernel);
+void             meta_shadow_set_kernel       (MetaShadowKernel kernel);
+MetaShadowKernel meta_shadow_get_kernel       (void);
+const char      *meta_shadow_kernel_name      (MetaShadowKernel kernel);
+
+#endif
@@ -0,0 +1,385 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Metacity shadow kernel benchmark */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Times building the shadow tables and filling shadow images with
+ * each of the kernels this CPU supports, against the double precision
+ * code they replaced, and checks the kernels agree with it.
+ *
+ *   testshadow [iterations]
+ */
+
+#include <config.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shadow-kernels.h"
+
+static const double radii[] = { 3.0, 6.0, 12.0, 24.0 };
+
+static const struct
+{
+  int width, height;
+} sizes[] = {
+  { 8, 8 },
+  { 300, 200 },
+  { 1280, 800 }
+};
+
+/* The reference implementation: a straight sum over the map in
+   double precision for every pixel of the tables */
+
+static guchar
+reference_sum_gaussian (conv   *map,
+                        double  opacity,
+                        int     x,
+                        int     y,
+                        int     width,
+                        int     height)
+{
+  double *g_data, *g_line;
+  double v;
+  int fx, fy;
+  int fx_start, fx_end;
+  int fy_start, fy_end;
+  int g_size, centre;
+
+  g_line = map->data;
+  g_size = map->size;
+  centre = g_size / 2;
+  fx_start = MAX (centre - x, 0);
+  fx_end = MIN (width + centre - x, g_size);
+  fy_start = MAX (centre - y, 0);
+  fy_end = MIN (height + centre - y, g_size);
+
+  g_line = g_line + fy_start * g_size + fx_start;
+
+  v = 0.0;
+  for (fy = fy_start; fy < fy_end; fy++)
+    {
+      g_data = g_line;
+      g_line += g_size;
+
+      for (fx = fx_start; fx < fx_end; fx++)
+        v += *g_data++;
+    }
+
+  if (v > 1.0)
+    v = 1.0;
+
+  return ((guchar) (v * opacity * 255.0));
+}
+
+static void
+reference_presum (conv    *map,
+                  guchar **corner_out,
+                  guchar **top_out)
+{
+  int msize = map->size;
+  int centre = msize / 2;
+  int stride = (msize + 1) * (msize + 1);
+  int opacity, x, y;
+  guchar *corner, *top;
+
+  corner = g_malloc (stride * SHADOW_OPACITY_LEVELS);
+  top = g_malloc ((msize + 1) * SHADOW_OPACITY_LEVELS);
+
+  for (x = 0; x <= msize; x++)
+    {
+      top[25 * (msize + 1) + x] =
+        reference_sum_gaussian (map, 1, x - centre, centre,
+                                msize * 2, msize * 2);
+      for (opacity = 0; opacity < 25; opacity++)
+        top[opacity * (msize + 1) + x] =
+          top[25 * (msize + 1) + x] * opacity / 25;
+
+      for (y = 0; y <= x; y++)
+        {
+          corner[25 * stride + y * (msize + 1) + x] =
+            reference_sum_gaussian (map, 1, x - centre, y - centre,
+                                    msize * 2, msize * 2);
+          corner[25 * stride + x * (msize + 1) + y] =
+            corner[25 * stride + y * (msize + 1) + x];
+
+          for (opacity = 0; opacity < 25; opacity++)
+            corner[opacity * stride + y * (msize + 1) + x] =
+              corner[opacity * stride + x * (msize + 1) + y] =
+              corner[25 * stride + y * (msize + 1) + x] * opacity / 25;
+        }
+    }
+
+  *corner_out = corner;
+  *top_out = top;
+}
+
+static void
+reference_fill (conv         *map,
+                const guchar *corner,
+                const guchar *top,
+                double        opacity,
+                int           width,
+                int           height,
+                guchar       *data)
+{
+  int msize = map->size;
+  int centre = msize / 2;
+  int swidth = width + msize;
+  int sheight = height + msize;
+  int opacity_int = (int) (opacity * 25);
+  int xlimit, ylimit, x_diff, x, y;
+  guchar d;
+
+  if (msize > 0)
+    d = top[opacity_int * (msize + 1) + msize];
+  else
+    d = reference_sum_gaussian (map, opacity, centre, centre, width, height);
+  memset (data, d, sheight * swidth);
+
+  ylimit = msize;
+  if (ylimit > sheight / 2)
+    ylimit = (sheight + 1) / 2;
+
+  xlimit = msize;
+  if (xlimit > swidth / 2)
+    xlimit = (swidth + 1) / 2;
+
+  for (y = 0; y < ylimit; y++)
+    for (x = 0; x < xlimit; x++)
+      {
+        if (xlimit == msize && ylimit == msize)
+          d = corner[opacity_int * (msize + 1) * (msize + 1) +
+                     y * (msize + 1) + x];
+        else
+          d = reference_sum_gaussian (map, opacity, x - centre,
+                                      y - centre, width, height);
+
+        data[y * swidth + x] = d;
+        data[(sheight - y - 1) * swidth + x] = d;
+        data[(sheight - y - 1) * swidth + (swidth - x - 1)] = d;
+        data[y * swidth + (swidth - x - 1)] = d;
+      }
+
+  x_diff = swidth - (msize * 2);
+  if (x_diff > 0 && ylimit > 0)
+    for (y = 0; y < ylimit; y++)
+      {
+        if (ylimit == msize)
+          d = top[opacity_int * (msize + 1) + y];
+        else
+          d = reference_sum_gaussian (map, opacity, centre,
+                                      y - centre, width, height);
+
+        memset (&data[y * swidth + msize], d, x_diff);
+        memset (&data[(sheight - y - 1) * swidth + msize], d, x_diff);
+      }
+
+  for (x = 0; x < xlimit; x++)
+    {
+      if (xlimit == msize)
+        d = top[opacity_int * (msize + 1) + x];
+      else
+        d = reference_sum_gaussian (map, opacity, x - centre,
+                                    centre, width, height);
+
+      for (y = msize; y < sheight - msize; y++)
+        {
+          data[y * swidth + x] = d;
+          data[y * swidth + (swidth - x - 1)] = d;
+        }
+    }
+}
+
+static int
+max_difference (const guchar *a,
+                const guchar *b,
+                int           n)
+{
+  int i, max = 0;
+
+  for (i = 0; i < n; i++)
+    max = MAX (max, ABS ((int) a[i] - (int) b[i]));
+
+  return max;
+}
+
+static double
+time_presum (int       iterations,
+             gboolean  reference,
+             conv     *map)
+{
+  gint64 start;
+  guchar *corner, *top;
+  int i;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; i++)
+    {
+      if (reference)
+        reference_presum (map, &corner, &top);
+      else
+        meta_shadow_presum (map, &corner, &top);
+
+      g_free (corner);
+      g_free (top);
+    }
+
+  return (double) (g_get_monotonic_time () - start) / iterations;
+}
+
+static double
+time_fill (int           iterations,
+           gboolean      reference,
+           conv         *map,
+           const guchar *corner,
+           const guchar *top,
+           int           width,
+           int           height,
+           guchar       *data)
+{
+  gint64 start;
+  int i;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; i++)
+    {
+      if (reference)
+        reference_fill (map, corner, top, 0.66, width, height, data);
+      else
+        meta_shadow_fill (map, corner, top, 0.66, width, height, data);
+    }
+
+  return (double) (g_get_monotonic_time () - start) / iterations;
+}
+
+int
+main (int argc, char **argv)
+{
+  int iterations = 200;
+  int failures = 0;
+  guint r;
+
+  if (argc > 1)
+    iterations = MAX (atoi (argv[1]), 1);
+
+  g_print ("%-8s %-12s %-8s %12s %10s %8s\n",
+           "radius", "operation", "kernel", "us/iter", "speedup", "maxdiff");
+
+  for (r = 0; r < G_N_ELEMENTS (radii); r++)
+    {
+      conv *map = meta_shadow_make_gaussian_map (radii[r]);
+      guchar *ref_corner, *ref_top;
+      double ref_time;
+      guint s;
+      int k;
+
+      reference_presum (map, &ref_corner, &ref_top);
+      ref_time = time_presum (iterations, TRUE, map);
+      g_print ("%-8.0f %-12s %-8s %12.2f %10s %8s\n",
+               radii[r], "presum", "double", ref_time, "", "");
+
+      for (k = 0; k < META_SHADOW_KERNEL_LAST; k++)
+        {
+          guchar *corner, *top;
+          double t;
+          int diff;
+
+          if (!meta_shadow_kernel_supported (k))
+            continue;
+
+          meta_shadow_set_kernel (k);
+          meta_shadow_presum (map, &corner, &top);
+          diff = MAX (max_difference (corner, ref_corner,
+                                      (map->size + 1) * (map->size + 1) *
+                                      SHADOW_OPACITY_LEVELS),
+                      max_difference (top, ref_top, (map->size + 1) *
+                                      SHADOW_OPACITY_LEVELS));
+          t = time_presum (iterations, FALSE, map);
+
+          g_print ("%-8.0f %-12s %-8s %12.2f %9.1fx %8d\n",
+                   radii[r], "presum", meta_shadow_kernel_name (k),
+                   t, ref_time / t, diff);
+
+          if (diff > 1)
+            failures++;
+
+          g_free (corner);
+          g_free (top);
+        }
+
+      for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+        {
+          int width = sizes[s].width, height = sizes[s].height;
+          int n = (width + map->size) * (height + map->size);
+          guchar *ref_data = g_malloc (n);
+          guchar *data = g_malloc (n);
+          char operation[32];
+
+          g_snprintf (operation, sizeof (operation), "fill %dx%d",
+                      width, height);
+
+          reference_fill (map, ref_corner, ref_top, 0.66,
+                          width, height, ref_data);
+          ref_time = time_fill (iterations, TRUE, map, ref_corner, ref_top,
+                                width, height, ref_data);
+          g_print ("%-8.0f %-12s %-8s %12.2f %10s %8s\n",
+                   radii[r], operation, "double", ref_time, "", "");
+
+          for (k = 0; k < META_SHADOW_KERNEL_LAST; k++)
+            {
+              double t;
+              int diff;
+
+              if (!meta_shadow_kernel_supported (k))
+                continue;
+
+              /* Fill from the reference tables so that only the fill
+                 itself is compared */
+              meta_shadow_set_kernel (k);
+              meta_shadow_fill (map, ref_corner, ref_top, 0.66,
+                                width, height, data);
+              diff = max_difference (data, ref_data, n);
+              t = time_fill (iterations, FALSE, map, ref_corner, ref_top,
+                             width, height, data);
+
+              g_print ("%-8.0f %-12s %-8s %12.2f %9.1fx %8d\n",
+                       radii[r], operation, meta_shadow_kernel_name (k),
+                       t, ref_time / t, diff);
+
+              if (diff > 1)
+                failures++;
+            }
+
+          g_free (ref_data);
+          g_free (data);
+        }
+
+      g_free (ref_corner);
+      g_free (ref_top);
+      g_free (map);
+    }
+
+  if (failures > 0)
+    g_printerr ("%d kernels differ from the reference by more than 1\n",
+                failures);
+
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,498 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Metacity asynchronous X requests */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This works like async-getprop.c: the requests are sent with the
+ * Xlib request macros, and an async handler picks their replies out
+ * of the stream by serial as Xlib reads it.  Replies come back in the
+ * order the requests were sent, so the next one we are waiting for is
+ * nearly always at the head of the queue.
+ */
+
+#include <config.h>
+#include "async-request.h"
+
+#include <string.h>
+
+#define NEED_REPLIES
+#include <X11/Xlibint.h>
+
+typedef enum
+{
+  REPLY_WINDOW_ATTRIBUTES,
+  REPLY_GEOMETRY,
+  REPLY_QUERY_TREE
+} ReplyType;
+
+/* GetWindowAttributes needs a GetGeometry too, so a request is sent
+ * as up to two X requests
+ */
+#define MAX_PARTS 2
+
+typedef struct
+{
+  MetaAsyncRequest *request;
+  ReplyType         type;
+  unsigned long     serial;
+  gboolean          have_reply;
+  int               error_code;
+
+  union
+  {
+    xGetWindowAttributesReply attributes;
+    xGetGeometryReply         geometry;
+    xQueryTreeReply           tree;
+  } reply;
+  CARD32           *children;
+} Part;
+
+typedef struct
+{
+  _XAsyncHandler  async;
+  Display        *xdisplay;
+  GQueue          pending;
+} AsyncDisplay;
+
+struct _MetaAsyncRequest
+{
+  AsyncDisplay *ad;
+  Part          parts[MAX_PARTS];
+  int           n_parts;
+  int           n_replies;
+  gboolean      cancelled;
+};
+
+static GSList *async_displays = NULL;
+static guint n_waits = 0;
+
+static void
+free_request (MetaAsyncRequest *request)
+{
+  int i;
+
+  for (i = 0; i < request->n_parts; i++)
+    g_free (request->parts[i].children);
+
+  g_free (request);
+}
+
+static Part*
+find_pending (AsyncDisplay  *ad,
+              unsigned long  serial)
+{
+  Part *part;
+  GList *link;
+
+  part = g_queue_peek_head (&ad->pending);
+  if (part == NULL || part->serial == serial)
+    return part;
+
+  for (link = ad->pending.head->next; link != NULL; link = link->next)
+    {
+      part = link->data;
+
+      if (part->serial == serial)
+        return part;
+      else if (part->serial > serial)
+        break;
+    }
+
+  return NULL;
+}
+
+/* Called by Xlib with the display locked, for every reply and error
+ * it reads while any of ours are pending
+ */
+static Bool
+async_reply_handler (Display *dpy,
+                     xReply  *rep,
+                     char    *buf,
+                     int      len,
+                     XPointer data)
+{
+  AsyncDisplay *ad = (AsyncDisplay *) data;
+  MetaAsyncRequest *request;
+  Part *part;
+  char *reply;
+
+  part = find_pending (ad, dpy->last_request_read);
+  if (part == NULL)
+    return False;
+
+  g_queue_remove (&ad->pending, part);
+
+  if (rep->generic.type == X_Error)
+    {
+      xError error;
+
+      part->error_code = rep->error.errorCode;
+      _XGetAsyncReply (dpy, (char *) &error, rep, buf, len,
+                       (SIZEOF (xError) - SIZEOF (xReply)) >> 2, False);
+    }
+  else
+    {
+      switch (part->type)
+        {
+        case REPLY_WINDOW_ATTRIBUTES:
+          reply = _XGetAsyncReply (dpy, (char *) &part->reply.attributes,
+                                   rep, buf, len,
+                                   (SIZEOF (xGetWindowAttributesReply) -
+                                    SIZEOF (xReply)) >> 2,
+                                   True);
+          memcpy (&part->reply.attributes, reply,
+                  sizeof (part->reply.attributes));
+          break;
+
+        case REPLY_GEOMETRY:
+          reply = _XGetAsyncReply (dpy, (char *) &part->reply.geometry,
+                                   rep, buf, len, 0, True);
+          memcpy (&part->reply.geometry, reply,
+                  sizeof (part->reply.geometry));
+          break;
+
+        case REPLY_QUERY_TREE:
+          reply = _XGetAsyncReply (dpy, (char *) &part->reply.tree,
+                                   rep, buf, len, 0, False);
+          memcpy (&part->reply.tree, reply, sizeof (part->reply.tree));
+
+          part->children = g_new (CARD32, part->reply.tree.nChildren);
+          _XGetAsyncData (dpy, (char *) part->children, buf, len,
+                          SIZEOF (xQueryTreeReply),
+                          part->reply.tree.nChildren << 2,
+                          part->reply.tree.length << 2);
+          break;
+        }
+    }
+
+  part->have_reply = TRUE;
+
+  request = part->request;
+  request->n_replies++;
+
+  if (request->cancelled && request->n_replies == request->n_parts)
+    free_request (request);
+
+  return True;
+}
+
+static AsyncDisplay*
+get_async_display (Display *dpy)
+{
+  AsyncDisplay *ad;
+  GSList *tmp;
+
+  for (tmp = async_displays; tmp != NULL; tmp = tmp->next)
+    {
+      ad = tmp->data;
+
+      if (ad->xdisplay == dpy)
+        return ad;
+    }
+
+  ad = g_new0 (AsyncDisplay, 1);
+  ad->xdisplay = dpy;
+  g_queue_init (&ad->pending);
+
+  ad->async.next = dpy->async_handlers;
+  ad->async.handler = async_reply_handler;
+  ad->async.data = (XPointer) ad;
+  dpy->async_handlers = &ad->async;
+
+  async_displays = g_slist_prepend (async_displays, ad);
+
+  return ad;
+}
+
+/* Must be called with the display locked, straight after the X
+ * request is queued
+ */
+static void
+add_part (MetaAsyncRequest *request,
+          ReplyType         type)
+{
+  Display *dpy = request->ad->xdisplay;
+  Part *part;
+
+  g_assert (request->n_parts < MAX_PARTS);
+
+  part = &request->parts[request->n_parts++];
+  part->request = request;
+  part->type = type;
+  part->serial = dpy->request;
+  part->error_code = Success;
+
+  g_queue_push_tail (&request->ad->pending, part);
+}
+
+MetaAsyncRequest*
+meta_async_get_window_attributes (Display *dpy,
+                                  Window   xwindow)
+{
+  MetaAsyncRequest *request;
+  xResourceReq *req;
+
+  LockDisplay (dpy);
+
+  request = g_new0 (MetaAsyncRequest, 1);
+  request->ad = get_async_display (dpy);
+
+  GetResReq (GetWindowAttributes, xwindow, req);
+  add_part (request, REPLY_WINDOW_ATTRIBUTES);
+
+  GetResReq (GetGeometry, xwindow, req);
+  add_part (request, REPLY_GEOMETRY);
+
+  UnlockDisplay (dpy);
+  SyncHandle ();
+
+  return request;
+}
+
+MetaAsyncRequest*
+meta_async_get_geometry (Display  *dpy,
+                         Drawable  drawable)
+{
+  MetaAsyncRequest *request;
+  xResourceReq *req;
+
+  LockDisplay (dpy);
+
+  request = g_new0 (MetaAsyncRequest, 1);
+  request->ad = get_async_display (dpy);
+
+  GetResReq (GetGeometry, drawable, req);
+  add_part (request, REPLY_GEOMETRY);
+
+  UnlockDisplay (dpy);
+  SyncHandle ();
+
+  return request;
+}
+
+MetaAsyncRequest*
+meta_async_query_tree (Display *dpy,
+                       Window   xwindow)
+{
+  MetaAsyncRequest *request;
+  xResourceReq *req;
+
+  LockDisplay (dpy);
+
+  request = g_new0 (MetaAsyncRequest, 1);
+  request->ad = get_async_display (dpy);
+
+  GetResReq (QueryTree, xwindow, req);
+  add_part (request, REPLY_QUERY_TREE);
+
+  UnlockDisplay (dpy);
+  SyncHandle ();
+
+  return request;
+}
+
+gboolean
+meta_async_request_is_ready (MetaAsyncRequest *request)
+{
+  return request->n_replies == request->n_parts;
+}
+
+void
+meta_async_request_cancel (MetaAsyncRequest *request)
+{
+  Display *dpy = request->ad->xdisplay;
+
+  /* The handler frees it when the last reply comes in */
+  LockDisplay (dpy);
+
+  if (meta_async_request_is_ready (request))
+    free_request (request);
+  else
+    request->cancelled = TRUE;
+
+  UnlockDisplay (dpy);
+}
+
+/* Returns the first error of the request's parts */
+static int
+wait_for_reply (MetaAsyncRequest *request)
+{
+  int i;
+
+  if (!meta_async_request_is_ready (request))
+    {
+      /* Every reply before the sync's own is read on the way */
+      n_waits++;
+      XSync (request->ad->xdisplay, False);
+    }
+
+  g_assert (meta_async_request_is_ready (request));
+
+  for (i = 0; i < request->n_parts; i++)
+    if (request->parts[i].error_code != Success)
+      return request->parts[i].error_code;
+
+  return Success;
+}
+
+int
+meta_async_get_window_attributes_reply (MetaAsyncRequest  *request,
+                                        XWindowAttributes *attrs)
+{
+  Display *dpy = request->ad->xdisplay;
+  xGetWindowAttributesReply *rep;
+  xGetGeometryReply *geometry;
+  int error_code;
+  int i;
+
+  g_return_val_if_fail (request->parts[0].type == REPLY_WINDOW_ATTRIBUTES,
+                        BadImplementation);
+
+  error_code = wait_for_reply (request);
+  if (error_code != Success)
+    {
+      free_request (request);
+      return error_code;
+    }
+
+  rep = &request->parts[0].reply.attributes;
+  geometry = &request->parts[1].reply.geometry;
+
+  /* As XGetWindowAttributes () fills it in */
+  attrs->class = rep->class;
+  attrs->bit_gravity = rep->bitGravity;
+  attrs->win_gravity = rep->winGravity;
+  attrs->backing_store = rep->backingStore;
+  attrs->backing_planes = rep->backingBitPlanes;
+  attrs->backing_pixel = rep->backingPixel;
+  attrs->save_under = rep->saveUnder;
+  attrs->colormap = rep->colormap;
+  attrs->map_installed = rep->mapInstalled;
+  attrs->map_state = rep->mapState;
+  attrs->all_event_masks = rep->allEventMasks;
+  attrs->your_event_mask = rep->yourEventMask;
+  attrs->do_not_propagate_mask = rep->doNotPropagateMask;
+  attrs->override_redirect = rep->override;
+
+  attrs->x = geometry->x;
+  attrs->y = geometry->y;
+  attrs->width = geometry->width;
+  attrs->height = geometry->height;
+  attrs->border_width = geometry->borderWidth;
+  attrs->depth = geometry->depth;
+  attrs->root = geometry->root;
+
+  LockDisplay (dpy);
+
+  attrs->visual = _XVIDtoVisual (dpy, rep->visualID);
+
+  attrs->screen = NULL;
+  for (i = 0; i < dpy->nscreens; i++)
+    if (dpy->screens[i].root == attrs->root)
+      {
+        attrs->screen = &dpy->screens[i];
+        break;
+      }
+
+  UnlockDisplay (dpy);
+
+  free_request (request);
+
+  return Success;
+}
+
+int
+meta_async_get_geometry_reply (MetaAsyncRequest *request,
+                               Window           *root,
+                               int              *x,
+                               int              *y,
+                               unsigned int     *width,
+                               unsigned int     *height,
+                               unsigned int     *border_width,
+                               unsigned int     *depth)
+{
+  xGetGeometryReply *rep;
+  int error_code;
+
+  g_return_val_if_fail (request->parts[0].type == REPLY_GEOMETRY,
+                        BadImplementation);
+
+  error_code = wait_for_reply (request);
+  if (error_code != Success)
+    {
+      free_request (request);
+      return error_code;
+    }
+
+  rep = &request->parts[0].reply.geometry;
+
+  *root = rep->root;
+  *x = rep->x;
+  *y = rep->y;
+  *width = rep->width;
+  *height = rep->height;
+  *border_width = rep->borderWidth;
+  *depth = rep->depth;
+
+  free_request (request);
+
+  return Success;
+}
+
+int
+meta_async_query_tree_reply (MetaAsyncRequest  *request,
+                             Window            *root,
+                             Window            *parent,
+                             Window           **children,
+                             unsigned int      *n_children)
+{
+  xQueryTreeReply *rep;
+  int error_code;
+  unsigned int i;
+
+  g_return_val_if_fail (request->parts[0].type == REPLY_QUERY_TREE,
+                        BadImplementation);
+
+  error_code = wait_for_reply (request);
+  if (error_code != Success)
+    {
+      free_request (request);
+      return error_code;
+    }
+
+  rep = &request->parts[0].reply.tree;
+
+  *root = rep->root;
+  *parent = rep->parent;
+  *n_children = rep->nChildren;
+
+  /* Window is a long, wider than the wire's CARD32 on 64-bit */
+  *children = g_new (Window, rep->nChildren);
+  for (i = 0; i < rep->nChildren; i++)
+    (*children)[i] = request->parts[0].children[i];
+
+  free_request (request);
+
+  return Success;
+}
+
+guint
+meta_async_request_get_n_waits (void)
+{
+  return n_waits;
+}
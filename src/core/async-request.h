@@ -0,0 +1,68 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Metacity asynchronous X requests */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef META_ASYNC_REQUEST_H
+#define META_ASYNC_REQUEST_H
+
+#include <glib.h>
+#include <X11/Xlib.h>
+
+/* A request sent to the server whose reply is collected later, so
+ * that many requests can share the wait for one round trip.  Replies
+ * and errors are read in the background as Xlib reads events; errors
+ * never reach the X error handler.
+ *
+ * Each request must be finished with exactly one of the _reply ()
+ * functions, which wait for the reply if it has not come yet, or with
+ * meta_async_request_cancel ().
+ */
+typedef struct _MetaAsyncRequest MetaAsyncRequest;
+
+MetaAsyncRequest *meta_async_get_window_attributes (Display  *xdisplay,
+                                                    Window    xwindow);
+MetaAsyncRequest *meta_async_get_geometry          (Display  *xdisplay,
+                                                    Drawable  drawable);
+MetaAsyncRequest *meta_async_query_tree            (Display  *xdisplay,
+                                                    Window    xwindow);
+
+gboolean meta_async_request_is_ready (MetaAsyncRequest *request);
+void     meta_async_request_cancel   (MetaAsyncRequest *request);
+
+/* The reply functions return the X error code, Success if none */
+int meta_async_get_window_attributes_reply (MetaAsyncRequest   *request,
+                                            XWindowAttributes  *attrs);
+int meta_async_get_geometry_reply          (MetaAsyncRequest   *request,
+                                            Window             *root,
+                                            int                *x,
+                                            int                *y,
+                                            unsigned int       *width,
+                                            unsigned int       *height,
+                                            unsigned int       *border_width,
+                                            unsigned int       *depth);
+/* children is freed with g_free () */
+int meta_async_query_tree_reply            (MetaAsyncRequest   *request,
+                                            Window             *root,
+                                            Window             *parent,
+                                            Window            **children,
+                                            unsigned int       *n_children);
+
+/* How many requests have had to wait for their reply */
+guint meta_async_request_get_n_waits (void);
+
+#endif
@@ -57,6 +57,9 @@ item(_METACITY_RELOAD_THEME_MESSAGE)
 item(_METACITY_SET_KEYBINDINGS_MESSAGE)
 item(_METACITY_SET_MOUSEMODS_MESSAGE)
 item(_METACITY_TOGGLE_VERBOSE)
+item(_METACITY_COMPOSITOR_STATS_MESSAGE)
+item(_METACITY_EVENT_STATS_MESSAGE)
+item(_METACITY_EVENT_STATS)
 item(_GNOME_PANEL_ACTION)
 item(_GNOME_PANEL_ACTION_MAIN_MENU)
 item(_GNOME_PANEL_ACTION_RUN_DIALOG)
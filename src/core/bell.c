@@ -104,6 +104,7 @@ bell_flash_screen (MetaDisplay *display,
 					    &xswa);
       XSelectInput (display->xdisplay, screen->flash_window, ExposureMask);
       XMapWindow (display->xdisplay, screen->flash_window);
+      meta_display_note_round_trip (display);
       XSync (display->xdisplay, False);
       XFlush (display->xdisplay);
       XUnmapWindow (display->xdisplay, screen->flash_window);
@@ -124,6 +125,7 @@ bell_flash_screen (MetaDisplay *display,
       XFillRectangle (display->xdisplay, screen->flash_window, gc,
 		      0, 0, width, height);
       XFlush (display->xdisplay);
+      meta_display_note_round_trip (display);
       XSync (display->xdisplay, False);
       XUnmapWindow (display->xdisplay, screen->flash_window);
       XFreeGC (display->xdisplay, gc);
@@ -70,6 +70,25 @@ typedef void (* MetaWindowPingFunc) (MetaDisplay *display,
  */
 #define N_IGNORED_SERIALS           4
 
+/* Event types are at most 127; the top bit of the type only says
+ * the event was sent by a client
+ */
+#define N_EVENT_TYPES               128
+#define N_GRAB_OPS                  (META_GRAB_OP_CLICKING_UNSTICK + 1)
+
+/* Time taken to handle events, in microseconds, and how long they
+ * waited before being handled, in milliseconds
+ */
+typedef struct
+{
+  guint  count;
+  gint64 total;
+  gint64 max;
+  guint  delayed;
+  gint64 delay_total;
+  gint64 delay_max;
+} MetaEventTiming;
+
 typedef enum {
   META_TILE_NONE,
   META_TILE_LEFT,
@@ -127,6 +146,28 @@ struct _MetaDisplay
   guint allow_terminal_deactivation : 1;
 
   guint static_gravity_works : 1;
+
+  /* Drop events made redundant by the next one in the queue */
+  guint compress_events : 1;
+  guint motion_events_collapsed;
+  guint configure_events_collapsed;
+  guint damage_events_collapsed;
+
+  /* Timings by event type and by the grab op the events came in */
+  MetaEventTiming event_timings[N_EVENT_TYPES];
+  MetaEventTiming grab_op_timings[N_GRAB_OPS];
+  /* The smallest difference seen between our clock and the server
+   * time of an event, taken as the time an event needs to arrive
+   */
+  gint32 event_time_offset;
+  guint event_time_offset_known : 1;
+
+  /* Blocking round trips to the server, counted by the operation in
+   * progress and the call site, as "operation location" keys
+   */
+  const char *operation;
+  GHashTable *round_trips;
+  guint round_trips_total;
   
   /*< private-ish >*/
   guint error_trap_synced_at_last_pop : 1;
@@ -371,6 +412,19 @@ GSList*     meta_display_list_windows        (MetaDisplay *display);
 MetaDisplay* meta_display_for_x_display  (Display     *xdisplay);
 MetaDisplay* meta_get_display            (void);
 
+/* Names what the display is doing, for the round trips it makes;
+ * returns the operation it replaces, to be put back afterwards
+ */
+const char* meta_display_set_operation    (MetaDisplay *display,
+                                           const char  *operation);
+void     meta_display_count_round_trip    (MetaDisplay *display,
+                                           const char  *location);
+#define meta_display_note_round_trip(display) \
+  meta_display_count_round_trip ((display), G_STRLOC)
+
+char*    meta_display_get_event_stats     (MetaDisplay *display);
+void     meta_display_publish_event_stats (MetaDisplay *display);
+
 Cursor         meta_display_create_x_cursor (MetaDisplay *display,
                                              MetaCursor   cursor);
 
@@ -418,7 +472,10 @@ void     meta_display_increment_event_serial (MetaDisplay *display);
 void     meta_display_update_active_window_hint (MetaDisplay *display);
 
 guint32  meta_display_get_current_time           (MetaDisplay *display);
-guint32  meta_display_get_current_time_roundtrip (MetaDisplay *display);
+guint32  meta_display_get_current_time_roundtrip_at (MetaDisplay *display,
+                                                    const char  *location);
+#define meta_display_get_current_time_roundtrip(display) \
+  meta_display_get_current_time_roundtrip_at ((display), G_STRLOC)
 
 /* utility goo */
 const char* meta_event_mode_to_string   (int m);
@@ -321,6 +321,7 @@ meta_display_open (void)
   GSList *tmp;
   int i;
   guint32 timestamp;
+  gint64 start;
 
   /* A list of all atom names, so that we can intern them in one go. */
   char *atom_names[] = {
@@ -332,6 +333,7 @@ meta_display_open (void)
   
   meta_verbose ("Opening display '%s'\n", XDisplayName (NULL));
 
+  start = g_get_monotonic_time ();
   xdisplay = meta_ui_get_display ();
   
   if (xdisplay == NULL)
@@ -378,6 +380,22 @@ meta_display_open (void)
   
   /* FIXME copy the checks from GDK probably */
   the_display->static_gravity_works = g_getenv ("METACITY_USE_STATIC_GRAVITY") != NULL;
+
+  the_display->compress_events = g_getenv ("METACITY_NO_EVENT_COMPRESSION") == NULL;
+  the_display->motion_events_collapsed = 0;
+  the_display->configure_events_collapsed = 0;
+  the_display->damage_events_collapsed = 0;
+
+  memset (the_display->event_timings, 0, sizeof (the_display->event_timings));
+  memset (the_display->grab_op_timings, 0,
+          sizeof (the_display->grab_op_timings));
+  the_display->event_time_offset = 0;
+  the_display->event_time_offset_known = FALSE;
+
+  the_display->operation = NULL;
+  the_display->round_trips = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, NULL);
+  the_display->round_trips_total = 0;
   
   meta_bell_init (the_display);
 
@@ -785,6 +803,10 @@ meta_display_open (void)
   /* Done opening new display */
   the_display->display_opening = FALSE;
 
+  meta_topic (META_DEBUG_STARTUP, "Display ready after %.1f ms, %u round trips\n",
+              (g_get_monotonic_time () - start) / 1000.0,
+              the_display->round_trips_total);
+
   return TRUE;
 }
 
@@ -889,6 +911,12 @@ meta_display_close (MetaDisplay *display,
   meta_ui_remove_event_func (display->xdisplay,
                              event_callback,
                              display);
+
+  meta_topic (META_DEBUG_EVENTS,
+              "Collapsed %u motion, %u configure and %u damage events\n",
+              display->motion_events_collapsed,
+              display->configure_events_collapsed,
+              display->damage_events_collapsed);
   
   /* Free all screens */
   tmp = display->screens;
@@ -929,6 +957,11 @@ meta_display_close (MetaDisplay *display,
 
   if (display->compositor)
     meta_compositor_destroy (display->compositor);
+
+  meta_topic (META_DEBUG_SYNC, "Made %u round trips to the server\n",
+              display->round_trips_total);
+  g_hash_table_destroy (display->round_trips);
+  display->round_trips = NULL;
   
   g_free (display);
   the_display = NULL;
@@ -965,6 +998,7 @@ meta_display_screen_for_xwindow (MetaDisplay *display,
   
   meta_error_trap_push (display);
   attr.screen = NULL;
+  meta_display_note_round_trip (display);
   result = XGetWindowAttributes (display->xdisplay, xwindow, &attr);
   meta_error_trap_pop (display, TRUE);
 
@@ -1203,7 +1237,8 @@ meta_display_get_current_time (MetaDisplay *display)
 
 /* Get a timestamp, even if it means a roundtrip */
 guint32
-meta_display_get_current_time_roundtrip (MetaDisplay *display)
+meta_display_get_current_time_roundtrip_at (MetaDisplay *display,
+                                            const char  *location)
 {
   guint32 timestamp;
   
@@ -1212,6 +1247,8 @@ meta_display_get_current_time_roundtrip (MetaDisplay *display)
     {
       XEvent property_event;
 
+      meta_display_count_round_trip (display, location);
+
       /* Using the property XA_PRIMARY because it's safe; nothing
        * would use it as a property. The type doesn't matter.
        */
@@ -1316,6 +1353,7 @@ window_raise_with_delay_callback (void *data)
       gboolean point_in_window;
 
       meta_error_trap_push (window->display);
+      meta_display_note_round_trip (window->display);
       same_screen = XQueryPointer (window->display->xdisplay,
 				   window->xwindow,
 				   &root, &child,
@@ -1363,39 +1401,104 @@ meta_display_queue_autoraise_callback (MetaDisplay *display,
   display->autoraise_window = window;
 }
 
-/**
- * This is the most important function in the whole program. It is the heart,
- * it is the nexus, it is the Grand Central Station of Metacity's world.
- * When we create a MetaDisplay, we ask GDK to pass *all* events for *all*
- * windows to this function. So every time anything happens that we might
- * want to know about, this function gets called. You see why it gets a bit
- * busy around here. Most of this function is a ginormous switch statement
- * dealing with all the kinds of events that might turn up.
- *
- * \param event The event that just happened
- * \param data  The MetaDisplay that events are coming from, cast to a gpointer
- *              so that it can be sent to a callback
- *
- * \ingroup main
+/* Whether the event is made redundant by the one after it, if that
+ * has already been read from the connection: pointer motion in the
+ * same window, a configure of the same window, or damage to the same
+ * drawable.  Nothing comes between the two, so dropping the first
+ * never reorders anything; the second carries the state that counts.
  */
 static gboolean
-event_callback (XEvent   *event,
-                gpointer  data)
+event_is_superseded (MetaDisplay *display,
+                     XEvent      *event)
+{
+  XEvent next;
+
+  switch (event->type)
+    {
+    case MotionNotify:
+    case ConfigureNotify:
+      break;
+    default:
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+      if (META_DISPLAY_HAS_DAMAGE (display) &&
+          event->type == display->damage_event_base + XDamageNotify)
+        break;
+#endif
+      return FALSE;
+    }
+
+  if (XEventsQueued (display->xdisplay, QueuedAlready) == 0)
+    return FALSE;
+
+  XPeekEvent (display->xdisplay, &next);
+
+  if (next.type != event->type)
+    return FALSE;
+
+  switch (event->type)
+    {
+    case MotionNotify:
+      /* Hints have to be answered with a pointer query, so they are
+       * never dropped
+       */
+      if (event->xmotion.is_hint != NotifyNormal ||
+          next.xmotion.is_hint != NotifyNormal ||
+          next.xmotion.window != event->xmotion.window ||
+          next.xmotion.subwindow != event->xmotion.subwindow ||
+          next.xmotion.state != event->xmotion.state ||
+          next.xmotion.same_screen != event->xmotion.same_screen)
+        return FALSE;
+
+      display->motion_events_collapsed++;
+      return TRUE;
+
+    case ConfigureNotify:
+      if (next.xconfigure.event != event->xconfigure.event ||
+          next.xconfigure.window != event->xconfigure.window)
+        return FALSE;
+
+      display->configure_events_collapsed++;
+      return TRUE;
+
+    default:
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+      {
+        XDamageNotifyEvent *damage = (XDamageNotifyEvent *) event;
+        XDamageNotifyEvent *next_damage = (XDamageNotifyEvent *) &next;
+
+        if (next_damage->drawable != damage->drawable ||
+            next_damage->damage != damage->damage)
+          return FALSE;
+
+        display->damage_events_collapsed++;
+        return TRUE;
+      }
+#else
+      return FALSE;
+#endif
+    }
+}
+
+/* Handles one event for event_callback () */
+static gboolean
+handle_event (MetaDisplay *display,
+              XEvent      *event)
 {
   MetaWindow *window;
   MetaWindow *property_for_window;
-  MetaDisplay *display;
   Window modified;
   gboolean frame_was_receiver;
   gboolean filter_out_event;
 
-  display = data;
-  
 #ifdef WITH_VERBOSE_MODE
   if (dump_events)
     meta_spew_event (display, event);
 #endif
 
+  /* Removing the event keeps GTK+ from seeing it as well */
+  if (display->compress_events && event_is_superseded (display, event))
+    return TRUE;
+
 #ifdef HAVE_STARTUP_NOTIFICATION
   sn_display_process_event (display->sn_display, event);
 #endif
@@ -2288,6 +2391,18 @@ event_callback (XEvent   *event,
                   meta_verbose ("Received toggle verbose message\n");
                   meta_set_verbose (!meta_is_verbose ());
                 }
+              else if (event->xclient.message_type ==
+                       display->atom__METACITY_COMPOSITOR_STATS_MESSAGE)
+                {
+                  meta_verbose ("Received compositor stats request\n");
+                  meta_compositor_publish_stats (display->compositor);
+                }
+              else if (event->xclient.message_type ==
+                       display->atom__METACITY_EVENT_STATS_MESSAGE)
+                {
+                  meta_verbose ("Received event stats request\n");
+                  meta_display_publish_event_stats (display);
+                }
 	      else if (event->xclient.message_type ==
 		       display->atom_WM_PROTOCOLS) 
 		{
@@ -2381,6 +2496,359 @@ event_callback (XEvent   *event,
   return filter_out_event;
 }
 
+/* Events taking longer than this to handle are logged as they happen */
+#define SLOW_EVENT_TIME 50000
+
+static void
+add_event_timing (MetaEventTiming *timing,
+                  gint64           time,
+                  gint64           delay)
+{
+  timing->count++;
+  timing->total += time;
+  timing->max = MAX (timing->max, time);
+
+  if (delay >= 0)
+    {
+      timing->delayed++;
+      timing->delay_total += delay;
+      timing->delay_max = MAX (timing->delay_max, delay);
+    }
+}
+
+static const char *
+event_type_name (MetaDisplay *display,
+                 int          type)
+{
+  static const char * const names[] = {
+    NULL, NULL, "KeyPress", "KeyRelease", "ButtonPress", "ButtonRelease",
+    "MotionNotify", "EnterNotify", "LeaveNotify", "FocusIn", "FocusOut",
+    "KeymapNotify", "Expose", "GraphicsExpose", "NoExpose",
+    "VisibilityNotify", "CreateNotify", "DestroyNotify", "UnmapNotify",
+    "MapNotify", "MapRequest", "ReparentNotify", "ConfigureNotify",
+    "ConfigureRequest", "GravityNotify", "ResizeRequest", "CirculateNotify",
+    "CirculateRequest", "PropertyNotify", "SelectionClear",
+    "SelectionRequest", "SelectionNotify", "ColormapNotify",
+    "ClientMessage", "MappingNotify", "GenericEvent"
+  };
+
+  if (type >= 0 && type < (int) G_N_ELEMENTS (names) && names[type] != NULL)
+    return names[type];
+
+#ifdef HAVE_XSYNC
+  if (META_DISPLAY_HAS_XSYNC (display) &&
+      type == display->xsync_event_base + XSyncAlarmNotify)
+    return "XSyncAlarmNotify";
+#endif
+#ifdef HAVE_SHAPE
+  if (META_DISPLAY_HAS_SHAPE (display) &&
+      type == display->shape_event_base + ShapeNotify)
+    return "ShapeNotify";
+#endif
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+  if (META_DISPLAY_HAS_DAMAGE (display) &&
+      type == display->damage_event_base + XDamageNotify)
+    return "DamageNotify";
+#endif
+
+  return NULL;
+}
+
+static const char * const grab_op_names[N_GRAB_OPS] = {
+  "none", "moving", "resizing-se", "resizing-s", "resizing-sw",
+  "resizing-n", "resizing-ne", "resizing-nw", "resizing-w", "resizing-e",
+  "keyboard-moving", "keyboard-resizing-unknown", "keyboard-resizing-s",
+  "keyboard-resizing-n", "keyboard-resizing-w", "keyboard-resizing-e",
+  "keyboard-resizing-se", "keyboard-resizing-ne", "keyboard-resizing-sw",
+  "keyboard-resizing-nw", "keyboard-tabbing-normal", "keyboard-tabbing-dock",
+  "keyboard-escaping-normal", "keyboard-escaping-dock",
+  "keyboard-escaping-group", "keyboard-tabbing-group",
+  "keyboard-workspace-switching", "clicking-minimize", "clicking-maximize",
+  "clicking-unmaximize", "clicking-delete", "clicking-menu",
+  "clicking-shade", "clicking-unshade", "clicking-above", "clicking-unabove",
+  "clicking-stick", "clicking-unstick"
+};
+
+/* Counts the time taken to handle an event against its type and the
+ * grab op it came in.  How long it waited is its server time against
+ * our clock, less the smallest such difference seen so far, so it is
+ * only known for events carrying a timestamp.
+ */
+static void
+record_event_timing (MetaDisplay *display,
+                     XEvent      *event,
+                     MetaGrabOp   grab_op,
+                     guint32      server_time,
+                     gint64       start,
+                     gint64       end)
+{
+  gint64 delay = -1;
+
+  if (server_time != CurrentTime && !event->xany.send_event)
+    {
+      gint32 offset = (gint32) ((guint32) (start / 1000) - server_time);
+
+      if (!display->event_time_offset_known ||
+          offset < display->event_time_offset)
+        {
+          display->event_time_offset = offset;
+          display->event_time_offset_known = TRUE;
+        }
+
+      delay = offset - display->event_time_offset;
+    }
+
+  add_event_timing (&display->event_timings[event->type & 0x7f],
+                    end - start, delay);
+  if (grab_op < N_GRAB_OPS)
+    add_event_timing (&display->grab_op_timings[grab_op], end - start, delay);
+
+  if (end - start > SLOW_EVENT_TIME)
+    meta_topic (META_DEBUG_EVENTS,
+                "Handling event type %d on 0x%lx during grab op %s "
+                "took %" G_GINT64_FORMAT " ms\n",
+                event->type, event->xany.window,
+                grab_op < N_GRAB_OPS ? grab_op_names[grab_op] : "unknown",
+                (end - start) / 1000);
+}
+
+/**
+ * This is the most important function in the whole program. It is the heart,
+ * it is the nexus, it is the Grand Central Station of Metacity's world.
+ * When we create a MetaDisplay, we ask GDK to pass *all* events for *all*
+ * windows to this function. So every time anything happens that we might
+ * want to know about, this function gets called. You see why it gets a bit
+ * busy around here. Most of the work is in handle_event (), a ginormous
+ * switch statement dealing with all the kinds of events that might turn up;
+ * this function times it.
+ *
+ * \param event The event that just happened
+ * \param data  The MetaDisplay that events are coming from, cast to a gpointer
+ *              so that it can be sent to a callback
+ *
+ * \ingroup main
+ */
+static gboolean
+event_callback (XEvent   *event,
+                gpointer  data)
+{
+  MetaDisplay *display = data;
+  MetaGrabOp grab_op = display->grab_op;
+  guint32 server_time = event_get_time (display, event);
+  gint64 start;
+  gboolean filtered;
+
+  /* Before anything reads the property again */
+  if (event->type == PropertyNotify)
+    meta_prop_invalidate (display, event->xproperty.window,
+                          event->xproperty.atom, event->xproperty.serial);
+
+  start = g_get_monotonic_time ();
+  filtered = handle_event (display, event);
+
+  /* Handling the event may have closed the display */
+  if (meta_get_display () == display)
+    record_event_timing (display, event, grab_op, server_time,
+                         start, g_get_monotonic_time ());
+
+  return filtered;
+}
+
+const char*
+meta_display_set_operation (MetaDisplay *display,
+                            const char  *operation)
+{
+  const char *old = display->operation;
+
+  display->operation = operation;
+
+  return old;
+}
+
+/* Counts a request that blocks until the server answers against the
+ * call site and the operation in progress, or the grab op if there
+ * is none.  Each one costs a full trip to the server and back, which
+ * is milliseconds over a remote connection.
+ */
+void
+meta_display_count_round_trip (MetaDisplay *display,
+                               const char  *location)
+{
+  const char *operation = display->operation;
+  char *key;
+  guint count;
+
+  if (display->round_trips == NULL)
+    return;
+
+  if (operation == NULL)
+    {
+      if (display->grab_op != META_GRAB_OP_NONE &&
+          display->grab_op < N_GRAB_OPS)
+        operation = grab_op_names[display->grab_op];
+      else
+        operation = "other";
+    }
+
+  key = g_strconcat (operation, " ", location, NULL);
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (display->round_trips, key));
+  g_hash_table_replace (display->round_trips, key,
+                        GUINT_TO_POINTER (count + 1));
+
+  display->round_trips_total++;
+}
+
+/* The call sites making the most round trips are listed */
+#define N_ROUND_TRIP_SITES 20
+
+static gint
+compare_round_trips (gconstpointer a,
+                     gconstpointer b,
+                     gpointer      data)
+{
+  GHashTable *round_trips = data;
+  guint count_a = GPOINTER_TO_UINT (g_hash_table_lookup (round_trips, a));
+  guint count_b = GPOINTER_TO_UINT (g_hash_table_lookup (round_trips, b));
+
+  if (count_a != count_b)
+    return count_a > count_b ? -1 : 1;
+
+  return strcmp (a, b);
+}
+
+static void
+append_round_trips (GString     *stats,
+                    MetaDisplay *display)
+{
+  GList *sites, *tmp;
+  int i;
+
+  g_string_append_printf (stats, "round-trips %u\n",
+                          display->round_trips_total);
+
+  sites = g_hash_table_get_keys (display->round_trips);
+  sites = g_list_sort_with_data (sites, compare_round_trips,
+                                 display->round_trips);
+
+  for (tmp = sites, i = 0; tmp && i < N_ROUND_TRIP_SITES; tmp = tmp->next, i++)
+    g_string_append_printf (stats, "round-trips-%s %u\n", (char *) tmp->data,
+                            GPOINTER_TO_UINT (g_hash_table_lookup (display->round_trips,
+                                                                   tmp->data)));
+
+  g_list_free (sites);
+}
+
+static void
+append_event_timing (GString               *stats,
+                     const char            *prefix,
+                     const char            *name,
+                     const MetaEventTiming *timing)
+{
+  g_string_append_printf (stats, "%s-%s-count %u\n",
+                          prefix, name, timing->count);
+  g_string_append_printf (stats, "%s-%s-time-total-us %" G_GINT64_FORMAT "\n",
+                          prefix, name, timing->total);
+  g_string_append_printf (stats, "%s-%s-time-max-us %" G_GINT64_FORMAT "\n",
+                          prefix, name, timing->max);
+
+  if (timing->delayed > 0)
+    {
+      g_string_append_printf (stats, "%s-%s-delay-mean-ms %" G_GINT64_FORMAT "\n",
+                              prefix, name,
+                              timing->delay_total / timing->delayed);
+      g_string_append_printf (stats, "%s-%s-delay-max-ms %" G_GINT64_FORMAT "\n",
+                              prefix, name, timing->delay_max);
+    }
+}
+
+/* Returns the event timings as "name value" lines, leaving out the
+ * event types and grab ops that never came up, followed by how many
+ * events of each kind were collapsed into a later one, the round trips
+ * made and the call sites making the most of them, and how often the
+ * property cache and the icon store were used (the "property-cache-"
+ * and "icon-store-" lines).  The round trips are a lower bound:
+ * queries made at startup (extensions, atoms, the keymap), lookups for
+ * debug output and the ones made by the ui and compositor code are not
+ * counted.  metacity-message event-stats prints this, and its man page
+ * describes it.
+ */
+char*
+meta_display_get_event_stats (MetaDisplay *display)
+{
+  GString *stats = g_string_new (NULL);
+  guint hits, misses;
+  guint n_icons, n_reads, n_shared;
+  int i;
+
+  for (i = 0; i < N_EVENT_TYPES; i++)
+    {
+      const char *name = event_type_name (display, i);
+      char *numbered = NULL;
+
+      if (display->event_timings[i].count == 0)
+        continue;
+
+      if (name == NULL)
+        name = numbered = g_strdup_printf ("type%d", i);
+
+      append_event_timing (stats, "event", name, &display->event_timings[i]);
+      g_free (numbered);
+    }
+
+  for (i = 0; i < N_GRAB_OPS; i++)
+    {
+      if (display->grab_op_timings[i].count == 0)
+        continue;
+
+      append_event_timing (stats, "grab-op", grab_op_names[i],
+                           &display->grab_op_timings[i]);
+    }
+
+  g_string_append_printf (stats, "events-collapsed-motion %u\n",
+                          display->motion_events_collapsed);
+  g_string_append_printf (stats, "events-collapsed-configure %u\n",
+                          display->configure_events_collapsed);
+  g_string_append_printf (stats, "events-collapsed-damage %u\n",
+                          display->damage_events_collapsed);
+  append_round_trips (stats, display);
+
+  meta_prop_get_cache_stats (&hits, &misses);
+  g_string_append_printf (stats, "property-cache-hits %u\n", hits);
+  g_string_append_printf (stats, "property-cache-misses %u\n", misses);
+
+  meta_icon_store_get_stats (&n_icons, &n_reads, &n_shared);
+  g_string_append_printf (stats, "icon-store-icons %u\n", n_icons);
+  g_string_append_printf (stats, "icon-store-reads %u\n", n_reads);
+  g_string_append_printf (stats, "icon-store-shared %u\n", n_shared);
+  if (n_reads > 0)
+    g_string_append_printf (stats, "icon-store-shared-percent %u\n",
+                            n_shared * 100 / n_reads);
+
+  return g_string_free (stats, FALSE);
+}
+
+/* Sets _METACITY_EVENT_STATS on the root windows, for
+ * metacity-message event-stats to pick up
+ */
+void
+meta_display_publish_event_stats (MetaDisplay *display)
+{
+  char *stats = meta_display_get_event_stats (display);
+  GSList *tmp;
+
+  for (tmp = display->screens; tmp != NULL; tmp = tmp->next)
+    {
+      MetaScreen *screen = tmp->data;
+
+      XChangeProperty (display->xdisplay, screen->xroot,
+                       display->atom__METACITY_EVENT_STATS,
+                       display->atom_UTF8_STRING, 8, PropModeReplace,
+                       (guchar *) stats, strlen (stats));
+    }
+
+  g_free (stats);
+}
+
 /* Return the window this has to do with, if any, rather
  * than the frame or root window that was selecting
  * for substructure
@@ -3176,6 +3644,7 @@ meta_display_set_grab_op_cursor (MetaDisplay *display,
       g_assert (screen != NULL);
 
       meta_error_trap_push (display);
+      meta_display_note_round_trip (display);
       if (XGrabPointer (display->xdisplay,
                         grab_xwindow,
                         False,
@@ -3205,6 +3674,23 @@ meta_display_set_grab_op_cursor (MetaDisplay *display,
     XFreeCursor (display->xdisplay, cursor);
 }
 
+#ifdef HAVE_XSYNC
+static void
+sync_request_alarm_failed (MetaDisplay *display,
+                           int          error_code,
+                           gpointer     data)
+{
+  XSyncAlarm alarm = (XSyncAlarm) GPOINTER_TO_SIZE (data);
+
+  meta_topic (META_DEBUG_RESIZING,
+              "Failed to create update alarm 0x%lx\n", alarm);
+
+  /* Unless the grab it was for has already ended */
+  if (display->grab_sync_request_alarm == alarm)
+    display->grab_sync_request_alarm = None;
+}
+#endif
+
 gboolean
 meta_display_begin_grab_op (MetaDisplay *display,
 			    MetaScreen  *screen,
@@ -3366,7 +3852,7 @@ meta_display_begin_grab_op (MetaDisplay *display,
           XSyncAlarmAttributes values;
 	  XSyncValue init;
 
-          meta_error_trap_push_with_return (display);
+          meta_error_trap_push_deferred (display);
 
 	  /* Set the counter to 0, so we know that the application's
 	   * responses to the client messages will always trigger
@@ -3404,8 +3890,9 @@ meta_display_begin_grab_op (MetaDisplay *display,
                                                          XSyncCAEvents,
                                                          &values);
 
-          if (meta_error_trap_pop_with_return (display, FALSE) != Success)
-	    display->grab_sync_request_alarm = None;
+          meta_error_trap_pop_deferred (display, sync_request_alarm_failed,
+                                        GSIZE_TO_POINTER (display->grab_sync_request_alarm),
+                                        NULL);
 
           meta_topic (META_DEBUG_RESIZING,
                       "Created update alarm 0x%lx\n",
@@ -3607,8 +4094,11 @@ meta_display_end_grab_op (MetaDisplay *display,
 #ifdef HAVE_XSYNC
   if (display->grab_sync_request_alarm != None)
     {
+      /* Creating it may have failed without our hearing yet */
+      meta_error_trap_push (display);
       XSyncDestroyAlarm (display->xdisplay,
                          display->grab_sync_request_alarm);
+      meta_error_trap_pop (display, FALSE);
       display->grab_sync_request_alarm = None;
     }
 #endif /* HAVE_XSYNC */
@@ -3652,6 +4142,14 @@ meta_display_check_threshold_reached (MetaDisplay *display,
     display->grab_threshold_movement_reached = TRUE;
 }
 
+static void
+button_grab_failed (MetaDisplay *display,
+                    int          error_code,
+                    gpointer     data)
+{
+  meta_verbose ("Failed to %s error code %d\n", (char *) data, error_code);
+}
+
 static void
 meta_change_button_grab (MetaDisplay *display,
                          Window       xwindow,
@@ -3682,7 +4180,7 @@ meta_change_button_grab (MetaDisplay *display,
         }
 
       if (meta_is_debugging ())
-        meta_error_trap_push_with_return (display);
+        meta_error_trap_push_deferred (display);
 
       /* GrabModeSync means freeze until XAllowEvents */
       
@@ -3699,16 +4197,12 @@ meta_change_button_grab (MetaDisplay *display,
                        xwindow);
 
       if (meta_is_debugging ())
-        {
-          int result;
-          
-          result = meta_error_trap_pop_with_return (display, FALSE);
-          
-          if (result != Success)
-            meta_verbose ("Failed to %s button %d with mask 0x%x for window 0x%lx error code %d\n",
-                          grab ? "grab" : "ungrab",
-                          button, modmask | ignored_mask, xwindow, result);
-        }
+        meta_error_trap_pop_deferred (display, button_grab_failed,
+                                      g_strdup_printf ("%s button %d with mask 0x%x for window 0x%lx",
+                                                       grab ? "grab" : "ungrab",
+                                                       button, modmask | ignored_mask,
+                                                       xwindow),
+                                      g_free);
       
       ++ignored_mask;
     }
@@ -4640,6 +5134,7 @@ convert_property (MetaDisplay *display,
    */
   /* FIXME the error trap pop synced anyway, right? */
   meta_topic (META_DEBUG_SYNC, "Syncing on %s\n", G_STRFUNC);
+  meta_display_note_round_trip (display);
   XSync (display->xdisplay, False);
 
   return TRUE;
@@ -4662,6 +5157,7 @@ process_selection_request (MetaDisplay   *display,
       char *str;
       
       meta_error_trap_push (display);
+      meta_display_note_round_trip (display);
       str = XGetAtomName (display->xdisplay,
                           event->xselectionrequest.selection);
       meta_error_trap_pop (display, TRUE);
@@ -4692,6 +5188,7 @@ process_selection_request (MetaDisplay   *display,
           unsigned char *data;
 
           meta_error_trap_push_with_return (display);
+          meta_display_note_round_trip (display);
           if (XGetWindowProperty (display->xdisplay,
                                   event->xselectionrequest.requestor,
                                   event->xselectionrequest.property, 0, 256, False,
@@ -4779,6 +5276,7 @@ process_selection_clear (MetaDisplay   *display,
     char *str;
             
     meta_error_trap_push (display);
+    meta_display_note_round_trip (display);
     str = XGetAtomName (display->xdisplay,
                         event->xselectionclear.selection);
     meta_error_trap_pop (display, TRUE);
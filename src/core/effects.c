@@ -321,6 +321,7 @@ graphics_sync (BoxAnimationContext *context)
 {
   XImage *image;
   
+  meta_display_note_round_trip (context->screen->display);
   image = XGetImage (context->screen->display->xdisplay,
                      context->screen->xroot,
                      0, 0, 1, 1,
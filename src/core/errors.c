@@ -26,6 +26,136 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <gdk/gdk.h>
+#include <X11/Xlibint.h>
+
+/* A deferred trap covers the requests from start_serial to
+ * end_serial, which is 0 until the trap is popped
+ */
+typedef struct
+{
+  MetaDisplay       *display;
+  unsigned long      start_serial;
+  unsigned long      end_serial;
+  int                error_code;
+  MetaErrorTrapFunc  func;
+  gpointer           data;
+  GDestroyNotify     destroy;
+} DeferredTrap;
+
+/* Pushed traps, innermost first */
+static GSList *pushed_traps = NULL;
+/* Popped traps still waiting to see if their requests fail, oldest
+ * first, and those that failed, waiting for their function to run
+ */
+static GQueue popped_traps = G_QUEUE_INIT;
+static GQueue failed_traps = G_QUEUE_INIT;
+static guint failed_traps_idle = 0;
+static _XAsyncHandler deferred_handler;
+static Display *hooked_xdisplay = NULL;
+
+static void
+free_trap (DeferredTrap *trap)
+{
+  if (trap->destroy)
+    (* trap->destroy) (trap->data);
+
+  g_free (trap);
+}
+
+static gboolean
+run_failed_traps (gpointer data)
+{
+  DeferredTrap *trap;
+
+  failed_traps_idle = 0;
+
+  while ((trap = g_queue_pop_head (&failed_traps)) != NULL)
+    {
+      meta_topic (META_DEBUG_ERRORS,
+                  "Deferred error trap for requests %lu to %lu got error %d\n",
+                  trap->start_serial, trap->end_serial, trap->error_code);
+
+      (* trap->func) (trap->display, trap->error_code, trap->data);
+      free_trap (trap);
+    }
+
+  return FALSE;
+}
+
+static void
+fail_trap (DeferredTrap *trap)
+{
+  g_queue_push_tail (&failed_traps, trap);
+
+  if (failed_traps_idle == 0)
+    failed_traps_idle = g_idle_add (run_failed_traps, NULL);
+}
+
+/* Once the server has got past a trap's last request, any error for
+ * it would have been read already
+ */
+static void
+forget_finished_traps (Display *xdisplay)
+{
+  unsigned long processed = LastKnownRequestProcessed (xdisplay);
+  DeferredTrap *trap;
+
+  while ((trap = g_queue_peek_head (&popped_traps)) != NULL &&
+         trap->end_serial <= processed)
+    {
+      g_queue_pop_head (&popped_traps);
+      free_trap (trap);
+    }
+}
+
+/* Xlib offers every error to the async handlers before any error
+ * handler, however it was read, so this must not make requests.
+ * Errors for popped traps are taken here; errors for pushed ones are
+ * noted, then left to the GDK trap underneath.
+ */
+static Bool
+deferred_error_handler (Display *xdisplay,
+                        xReply  *rep,
+                        char    *buf,
+                        int      len,
+                        XPointer data)
+{
+  unsigned long serial;
+  GList *link;
+  GSList *tmp;
+
+  if (rep->generic.type != X_Error)
+    return False;
+
+  serial = LastKnownRequestProcessed (xdisplay);
+
+  for (link = popped_traps.head; link != NULL; link = link->next)
+    {
+      DeferredTrap *trap = link->data;
+
+      if (serial >= trap->start_serial && serial <= trap->end_serial)
+        {
+          g_queue_delete_link (&popped_traps, link);
+          trap->error_code = rep->error.errorCode;
+          fail_trap (trap);
+
+          return True;
+        }
+    }
+
+  for (tmp = pushed_traps; tmp != NULL; tmp = tmp->next)
+    {
+      DeferredTrap *trap = tmp->data;
+
+      if (serial >= trap->start_serial && trap->error_code == Success)
+        {
+          trap->error_code = rep->error.errorCode;
+          break;
+        }
+    }
+
+  return False;
+}
 
 void
 meta_errors_init (void)
@@ -39,6 +169,73 @@ meta_errors_register_foreign_display (Display      *foreign_dpy,
 {
 }
 
+void
+meta_error_trap_push_deferred (MetaDisplay *display)
+{
+  DeferredTrap *trap;
+
+  if (hooked_xdisplay != display->xdisplay)
+    {
+      Display *dpy = display->xdisplay;
+
+      /* The handler stays on dpy->async_handlers for as long as the
+       * display is open; it is never dequeued, so deferred_handler
+       * must outlive it.  This relies on _XError offering each error
+       * to the async handlers before calling any error handler, which
+       * is Xlib internals rather than API.
+       */
+      LockDisplay (dpy);
+      deferred_handler.next = dpy->async_handlers;
+      deferred_handler.handler = deferred_error_handler;
+      deferred_handler.data = NULL;
+      dpy->async_handlers = &deferred_handler;
+      UnlockDisplay (dpy);
+
+      hooked_xdisplay = dpy;
+    }
+
+  gdk_error_trap_push ();
+
+  trap = g_new0 (DeferredTrap, 1);
+  trap->display = display;
+  trap->start_serial = NextRequest (display->xdisplay);
+  trap->error_code = Success;
+  pushed_traps = g_slist_prepend (pushed_traps, trap);
+}
+
+void
+meta_error_trap_pop_deferred (MetaDisplay       *display,
+                              MetaErrorTrapFunc  func,
+                              gpointer           data,
+                              GDestroyNotify     destroy)
+{
+  DeferredTrap *trap;
+
+  g_return_if_fail (pushed_traps != NULL);
+
+  trap = pushed_traps->data;
+  pushed_traps = g_slist_delete_link (pushed_traps, pushed_traps);
+
+  trap->end_serial = NextRequest (display->xdisplay) - 1;
+  trap->func = func;
+  trap->data = data;
+  trap->destroy = destroy;
+
+  gdk_error_trap_pop_ignored ();
+
+  if (trap->error_code != Success)
+    fail_trap (trap);
+  else if (trap->end_serial < trap->start_serial)
+    {
+      /* No requests were made */
+      free_trap (trap);
+    }
+  else
+    g_queue_push_tail (&popped_traps, trap);
+
+  forget_finished_traps (display->xdisplay);
+}
+
 void
 meta_error_trap_push (MetaDisplay *display)
 {
@@ -59,8 +256,17 @@ meta_error_trap_push_with_return (MetaDisplay *display)
 }
 
 int
-meta_error_trap_pop_with_return  (MetaDisplay *display,
-                                  gboolean     last_request_was_roundtrip)
+meta_error_trap_pop_with_return_at (MetaDisplay *display,
+                                    gboolean     last_request_was_roundtrip,
+                                    const char  *location)
 {
+  /* gdk only syncs when the last request has not been answered yet;
+   * one that came with a reply was counted where it was made
+   */
+  if (display != NULL &&
+      NextRequest (display->xdisplay) - 1 !=
+      LastKnownRequestProcessed (display->xdisplay))
+    meta_display_count_round_trip (display, location);
+
   return gdk_error_trap_pop ();
 }
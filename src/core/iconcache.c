@@ -23,9 +23,16 @@
 #include "iconcache.h"
 #include "ui.h"
 #include "errors.h"
+#include "xprops.h"
 
 #include <X11/Xatom.h>
 
+static GdkPixbuf* scaled_from_pixdata (guchar *pixdata,
+                                       int     w,
+                                       int     h,
+                                       int     new_w,
+                                       int     new_h);
+
 /* The icon-reading code is also in libwnck, please sync bugfixes */
 
 static void
@@ -204,6 +211,158 @@ argbdata_to_pixdata (gulong *argb_data, int len, guchar **pixdata)
     }
 }
 
+/* Windows with the same _NET_WM_ICON, such as many terminals, share
+ * one pair of pixbufs.  They are found by a checksum of the ARGB data
+ * they are made from and the sizes asked for, before converting it.
+ * The store holds no reference; an icon is forgotten when either of
+ * its pixbufs is finalized.
+ */
+typedef struct
+{
+  char      *key;
+  GdkPixbuf *icon;
+  GdkPixbuf *mini_icon;
+} StoredIcon;
+
+static GHashTable *icon_store = NULL;
+static guint icon_store_reads = 0;
+static guint icon_store_hits = 0;
+
+static void
+stored_icon_finalized (gpointer  data,
+                       GObject  *where_the_object_was)
+{
+  StoredIcon *stored = data;
+
+  if (G_OBJECT (stored->icon) != where_the_object_was)
+    g_object_weak_unref (G_OBJECT (stored->icon),
+                         stored_icon_finalized, stored);
+  if (G_OBJECT (stored->mini_icon) != where_the_object_was)
+    g_object_weak_unref (G_OBJECT (stored->mini_icon),
+                         stored_icon_finalized, stored);
+
+  g_hash_table_remove (icon_store, stored->key);
+  g_free (stored->key);
+  g_free (stored);
+}
+
+static char*
+icon_store_key (gulong *best,
+                int     w,
+                int     h,
+                gulong *best_mini,
+                int     mini_w,
+                int     mini_h,
+                int     ideal_width,
+                int     ideal_height,
+                int     ideal_mini_width,
+                int     ideal_mini_height)
+{
+  GChecksum *checksum;
+  char *key;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_checksum_update (checksum, (guchar *) best, w * h * sizeof (gulong));
+  g_checksum_update (checksum, (guchar *) best_mini,
+                     mini_w * mini_h * sizeof (gulong));
+
+  key = g_strdup_printf ("%s %dx%d %dx%d %dx%d %dx%d",
+                         g_checksum_get_string (checksum),
+                         w, h, mini_w, mini_h,
+                         ideal_width, ideal_height,
+                         ideal_mini_width, ideal_mini_height);
+
+  g_checksum_free (checksum);
+
+  return key;
+}
+
+static gboolean
+icons_from_argbdata (gulong     *best,
+                     int         w,
+                     int         h,
+                     gulong     *best_mini,
+                     int         mini_w,
+                     int         mini_h,
+                     GdkPixbuf **iconp,
+                     int         ideal_width,
+                     int         ideal_height,
+                     GdkPixbuf **mini_iconp,
+                     int         ideal_mini_width,
+                     int         ideal_mini_height)
+{
+  StoredIcon *stored;
+  guchar *pixdata;
+  guchar *mini_pixdata;
+  char *key;
+
+  if (icon_store == NULL)
+    icon_store = g_hash_table_new (g_str_hash, g_str_equal);
+
+  key = icon_store_key (best, w, h, best_mini, mini_w, mini_h,
+                        ideal_width, ideal_height,
+                        ideal_mini_width, ideal_mini_height);
+
+  icon_store_reads++;
+
+  stored = g_hash_table_lookup (icon_store, key);
+  if (stored != NULL)
+    {
+      icon_store_hits++;
+      g_free (key);
+
+      *iconp = g_object_ref (stored->icon);
+      *mini_iconp = g_object_ref (stored->mini_icon);
+
+      return TRUE;
+    }
+
+  argbdata_to_pixdata (best, w * h, &pixdata);
+  argbdata_to_pixdata (best_mini, mini_w * mini_h, &mini_pixdata);
+
+  *iconp = scaled_from_pixdata (pixdata, w, h,
+                                ideal_width, ideal_height);
+  *mini_iconp = scaled_from_pixdata (mini_pixdata, mini_w, mini_h,
+                                     ideal_mini_width, ideal_mini_height);
+
+  if (*iconp == NULL || *mini_iconp == NULL)
+    {
+      if (*iconp)
+        g_object_unref (G_OBJECT (*iconp));
+      if (*mini_iconp)
+        g_object_unref (G_OBJECT (*mini_iconp));
+
+      *iconp = NULL;
+      *mini_iconp = NULL;
+      g_free (key);
+
+      return FALSE;
+    }
+
+  stored = g_new (StoredIcon, 1);
+  stored->key = key;
+  stored->icon = *iconp;
+  stored->mini_icon = *mini_iconp;
+
+  g_object_weak_ref (G_OBJECT (stored->icon), stored_icon_finalized, stored);
+  g_object_weak_ref (G_OBJECT (stored->mini_icon),
+                     stored_icon_finalized, stored);
+
+  g_hash_table_insert (icon_store, stored->key, stored);
+
+  return TRUE;
+}
+
+void
+meta_icon_store_get_stats (guint *n_icons,
+                           guint *n_reads,
+                           guint *n_hits)
+{
+  *n_icons = icon_store ? g_hash_table_size (icon_store) : 0;
+  *n_reads = icon_store_reads;
+  *n_hits = icon_store_hits;
+}
+
 static gboolean
 read_rgb_icon (MetaDisplay   *display,
                Window         xwindow,
@@ -211,12 +370,8 @@ read_rgb_icon (MetaDisplay   *display,
                int            ideal_height,
                int            ideal_mini_width,
                int            ideal_mini_height,
-               int           *width,
-               int           *height,
-               guchar       **pixdata,
-               int           *mini_width,
-               int           *mini_height,
-               guchar       **mini_pixdata)
+               GdkPixbuf    **iconp,
+               GdkPixbuf    **mini_iconp)
 {
   Atom type;
   int format;
@@ -229,21 +384,30 @@ read_rgb_icon (MetaDisplay   *display,
   gulong *best_mini;
   int mini_w, mini_h;
   gulong *data_as_long;
+  gboolean found;
 
-  meta_error_trap_push_with_return (display);
   type = None;
   data = NULL;
-  result = XGetWindowProperty (display->xdisplay,
-			       xwindow,
-                               display->atom__NET_WM_ICON,
-			       0, G_MAXLONG,
-			       False, XA_CARDINAL, &type, &format, &nitems,
-			       &bytes_after, &data);
-  err = meta_error_trap_pop_with_return (display, TRUE);
-
-  if (err != Success ||
-      result != Success)
-    return FALSE;
+
+  if (!meta_prop_get_prefetched (display, xwindow,
+                                 display->atom__NET_WM_ICON, XA_CARDINAL,
+                                 &type, &format, &nitems,
+                                 &bytes_after, &data))
+    {
+      meta_error_trap_push_with_return (display);
+      meta_display_note_round_trip (display);
+      result = XGetWindowProperty (display->xdisplay,
+                                   xwindow,
+                                   display->atom__NET_WM_ICON,
+                                   0, G_MAXLONG,
+                                   False, XA_CARDINAL, &type, &format, &nitems,
+                                   &bytes_after, &data);
+      err = meta_error_trap_pop_with_return (display, TRUE);
+
+      if (err != Success ||
+          result != Success)
+        return FALSE;
+    }
 
   if (type != XA_CARDINAL)
     {
@@ -269,18 +433,13 @@ read_rgb_icon (MetaDisplay   *display,
       return FALSE;
     }
 
-  *width = w;
-  *height = h;
-
-  *mini_width = mini_w;
-  *mini_height = mini_h;
-
-  argbdata_to_pixdata (best, w * h, pixdata);
-  argbdata_to_pixdata (best_mini, mini_w * mini_h, mini_pixdata);
+  found = icons_from_argbdata (best, w, h, best_mini, mini_w, mini_h,
+                               iconp, ideal_width, ideal_height,
+                               mini_iconp, ideal_mini_width, ideal_mini_height);
 
   XFree (data);
 
-  return TRUE;
+  return found;
 }
 
 static void
@@ -309,6 +468,7 @@ get_pixmap_geometry (MetaDisplay *display,
   if (d)
     *d = 1;
 
+  meta_display_note_round_trip (display);
   XGetGeometry (display->xdisplay,
                 pixmap, &root_ignored, &x_ignored, &y_ignored,
                 &width, &height, &border_width_ignored, &depth);
@@ -469,21 +629,32 @@ get_kwm_win_icon (MetaDisplay *display,
   *pixmap = None;
   *mask = None;
 
-  meta_error_trap_push_with_return (display);
-  icons = NULL;
-  result = XGetWindowProperty (display->xdisplay, xwindow,
-                               display->atom__KWM_WIN_ICON,
-			       0, G_MAXLONG,
-			       False,
-                               display->atom__KWM_WIN_ICON,
-			       &type, &format, &nitems,
-			       &bytes_after, &data);
-  icons = (Pixmap *)data;
+  type = None;
+  data = NULL;
+
+  if (!meta_prop_get_prefetched (display, xwindow,
+                                 display->atom__KWM_WIN_ICON,
+                                 display->atom__KWM_WIN_ICON,
+                                 &type, &format, &nitems,
+                                 &bytes_after, &data))
+    {
+      meta_error_trap_push_with_return (display);
+      meta_display_note_round_trip (display);
+      result = XGetWindowProperty (display->xdisplay, xwindow,
+                                   display->atom__KWM_WIN_ICON,
+                                   0, G_MAXLONG,
+                                   False,
+                                   display->atom__KWM_WIN_ICON,
+                                   &type, &format, &nitems,
+                                   &bytes_after, &data);
+
+      err = meta_error_trap_pop_with_return (display, TRUE);
+      if (err != Success ||
+          result != Success)
+        return;
+    }
 
-  err = meta_error_trap_pop_with_return (display, TRUE);
-  if (err != Success ||
-      result != Success)
-    return;
+  icons = (Pixmap *)data;
 
   if (type != display->atom__KWM_WIN_ICON)
     {
@@ -680,10 +851,6 @@ meta_read_icons (MetaScreen     *screen,
                  int             ideal_mini_width,
                  int             ideal_mini_height)
 {
-  guchar *pixdata;
-  int w, h;
-  guchar *mini_pixdata;
-  int mini_w, mini_h;
   Pixmap pixmap;
   Pixmap mask;
 
@@ -710,8 +877,6 @@ meta_read_icons (MetaScreen     *screen,
   if (!meta_icon_cache_get_icon_invalidated (icon_cache))
     return FALSE; /* we have no new info to use */
 
-  pixdata = NULL;
-
   /* Our algorithm here assumes that we can't have for example origin
    * < USING_NET_WM_ICON and icon_cache->net_wm_icon_dirty == FALSE
    * unless we have tried to read NET_WM_ICON.
@@ -730,29 +895,12 @@ meta_read_icons (MetaScreen     *screen,
       if (read_rgb_icon (screen->display, xwindow,
                          ideal_width, ideal_height,
                          ideal_mini_width, ideal_mini_height,
-                         &w, &h, &pixdata,
-                         &mini_w, &mini_h, &mini_pixdata))
+                         iconp, mini_iconp))
         {
-          *iconp = scaled_from_pixdata (pixdata, w, h,
-                                        ideal_width, ideal_height);
-
-          *mini_iconp = scaled_from_pixdata (mini_pixdata, mini_w, mini_h,
-                                             ideal_mini_width, ideal_mini_height);
+          replace_cache (icon_cache, USING_NET_WM_ICON,
+                         *iconp, *mini_iconp);
 
-          if (*iconp && *mini_iconp)
-            {
-              replace_cache (icon_cache, USING_NET_WM_ICON,
-                             *iconp, *mini_iconp);
-              
-              return TRUE;
-            }
-          else
-            {
-              if (*iconp)
-                g_object_unref (G_OBJECT (*iconp));
-              if (*mini_iconp)
-                g_object_unref (G_OBJECT (*mini_iconp));
-            }
+          return TRUE;
         }
     }
 
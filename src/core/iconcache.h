@@ -70,6 +70,14 @@ gboolean meta_read_icons         (MetaScreen     *screen,
                                   int             ideal_mini_width,
                                   int             ideal_mini_height);
 
+/* Icons read from _NET_WM_ICON are shared between windows with the
+ * same one: how many are held, how many times one was read, and how
+ * many of those found it already held
+ */
+void     meta_icon_store_get_stats (guint *n_icons,
+                                    guint *n_reads,
+                                    guint *n_hits);
+
 #endif
 
 
@@ -665,6 +665,27 @@ keysym_name (int keysym)
   return name;
 }
 
+typedef struct
+{
+  int          keysym;
+  unsigned int mask;
+} KeyGrab;
+
+static void
+key_grab_failed (MetaDisplay *display,
+                 int          error_code,
+                 gpointer     data)
+{
+  KeyGrab *key_grab = data;
+
+  if (error_code == BadAccess)
+    meta_warning (_("Some other program is already using the key %s with modifiers %x as a binding\n"), keysym_name (key_grab->keysym), key_grab->mask);
+  else
+    meta_topic (META_DEBUG_KEYBINDINGS,
+                "Failed to grab key %s with modifiers %x\n",
+                keysym_name (key_grab->keysym), key_grab->mask);
+}
+
 /* Grab/ungrab, ignoring all annoying modifiers like NumLock etc. */
 static void
 meta_change_keygrab (MetaDisplay *display,
@@ -702,8 +723,8 @@ meta_change_keygrab (MetaDisplay *display,
           continue;
         }
 
-      if (meta_is_debugging ())
-        meta_error_trap_push_with_return (display);
+      if (grab && meta_is_debugging ())
+        meta_error_trap_push_deferred (display);
       if (grab)
         XGrabKey (display->xdisplay, keycode,
                   modmask | ignored_mask,
@@ -715,21 +736,16 @@ meta_change_keygrab (MetaDisplay *display,
                     modmask | ignored_mask,
                     xwindow);
 
-      if (meta_is_debugging ())
+      if (grab && meta_is_debugging ())
         {
-          int result;
-          
-          result = meta_error_trap_pop_with_return (display, FALSE);
-          
-          if (grab && result != Success)
-            {      
-              if (result == BadAccess)
-                meta_warning (_("Some other program is already using the key %s with modifiers %x as a binding\n"), keysym_name (keysym), modmask | ignored_mask);
-              else
-                meta_topic (META_DEBUG_KEYBINDINGS,
-                            "Failed to grab key %s with modifiers %x\n",
-                            keysym_name (keysym), modmask | ignored_mask);
-            }
+          KeyGrab *key_grab;
+
+          key_grab = g_new (KeyGrab, 1);
+          key_grab->keysym = keysym;
+          key_grab->mask = modmask | ignored_mask;
+
+          meta_error_trap_pop_deferred (display, key_grab_failed,
+                                        key_grab, g_free);
         }
 
       ++ignored_mask;
@@ -780,12 +796,22 @@ grab_keys (MetaKeyBinding *bindings,
   meta_error_trap_pop (display, FALSE);
 }
 
+static void
+ungrab_all_keys_failed (MetaDisplay *display,
+                        int          error_code,
+                        gpointer     data)
+{
+  meta_topic (META_DEBUG_KEYBINDINGS,
+              "Ungrabbing all keys on 0x%lx failed\n",
+              (Window) GPOINTER_TO_SIZE (data));
+}
+
 static void
 ungrab_all_keys (MetaDisplay *display,
                  Window       xwindow)
 {
   if (meta_is_debugging ())
-    meta_error_trap_push_with_return (display);
+    meta_error_trap_push_deferred (display);
   else
     meta_error_trap_push (display);
 
@@ -793,15 +819,8 @@ ungrab_all_keys (MetaDisplay *display,
               xwindow);
 
   if (meta_is_debugging ())
-    {
-      int result;
-      
-      result = meta_error_trap_pop_with_return (display, FALSE);
-      
-      if (result != Success)    
-        meta_topic (META_DEBUG_KEYBINDINGS,
-                    "Ungrabbing all keys on 0x%lx failed\n", xwindow);
-    }
+    meta_error_trap_pop_deferred (display, ungrab_all_keys_failed,
+                                  GSIZE_TO_POINTER (xwindow), NULL);
   else
     meta_error_trap_pop (display, FALSE);
 }
@@ -926,6 +945,7 @@ grab_keyboard (MetaDisplay *display,
    */
   meta_error_trap_push_with_return (display);
 
+  meta_display_note_round_trip (display);
   grab_status = XGrabKeyboard (display->xdisplay,
                                xwindow, True,
                                GrabModeAsync, GrabModeAsync,
@@ -1195,6 +1215,7 @@ primary_modifier_still_pressed (MetaDisplay *display,
   
   random_screen = display->screens->data;
   random_xwindow = random_screen->no_focus_window;
+  meta_display_note_round_trip (display);
   XQueryPointer (display->xdisplay,
                  random_xwindow, /* some random window */
                  &root, &child,
@@ -53,6 +53,7 @@
 
 #include <glib-object.h>
 #include <glib/gprintf.h>
+#include <glib-unix.h>
 
 #include <stdlib.h>
 #include <sys/types.h>
@@ -389,6 +390,23 @@ on_sigterm (void)
   return FALSE;
 }
 
+/* Prints how long the display took to handle events */
+static gboolean
+on_sigusr1 (gpointer data)
+{
+  MetaDisplay *display = meta_get_display ();
+
+  if (display != NULL)
+    {
+      char *stats = meta_display_get_event_stats (display);
+
+      g_printerr ("%s", stats);
+      g_free (stats);
+    }
+
+  return TRUE;
+}
+
 /**
  * This is where the story begins. It parses commandline options and
  * environment variables, sets up the screen, hands control off to
@@ -444,6 +462,8 @@ main (int argc, char **argv)
     g_printerr ("Failed to register SIGTERM handler: %s\n",
 		g_strerror (errno));
 
+  g_unix_signal_add (SIGUSR1, on_sigusr1, NULL);
+
   if (g_getenv ("METACITY_VERBOSE"))
     meta_set_verbose (TRUE);
   if (g_getenv ("METACITY_DEBUG"))
@@ -36,6 +36,7 @@
 #include "stack.h"
 #include "xprops.h"
 #include "compositor.h"
+#include "async-request.h"
 
 #ifdef HAVE_SOLARIS_XINERAMA
 #include <X11/extensions/xinerama.h>
@@ -725,36 +726,43 @@ list_windows (MetaScreen *screen)
   Window ignored1, ignored2;
   Window *children;
   guint n_children, i;
+  MetaAsyncRequest **requests;
   GList *result;
 
+  meta_display_note_round_trip (screen->display);
   XQueryTree (screen->display->xdisplay,
               screen->xroot,
               &ignored1, &ignored2, &children, &n_children);
 
+  /* Ask for all the attributes before waiting for any */
+  requests = g_new (MetaAsyncRequest*, n_children);
+  for (i = 0; i < n_children; ++i)
+    requests[i] = meta_async_get_window_attributes (screen->display->xdisplay,
+                                                    children[i]);
+
   result = NULL;
   for (i = 0; i < n_children; ++i)
     {
       WindowInfo *info = g_new0 (WindowInfo, 1);
 
-      meta_error_trap_push_with_return (screen->display);
-      
-      XGetWindowAttributes (screen->display->xdisplay,
-                            children[i], &info->attrs);
+      if (!meta_async_request_is_ready (requests[i]))
+        meta_display_note_round_trip (screen->display);
 
-      if (meta_error_trap_pop_with_return (screen->display, TRUE))
+      if (meta_async_get_window_attributes_reply (requests[i],
+                                                  &info->attrs) != Success)
 	{
           meta_verbose ("Failed to get attributes for window 0x%lx\n",
                         children[i]);
 	  g_free (info);
+          continue;
         }
-      else
-        {
-	  info->xwindow = children[i];
-	}
 
+      info->xwindow = children[i];
       result = g_list_prepend (result, info);
     }
 
+  g_free (requests);
+
   if (children)
     XFree (children);
 
@@ -766,11 +774,30 @@ meta_screen_manage_all_windows (MetaScreen *screen)
 {
   GList *windows;
   GList *list;
+  const char *operation;
+  gint64 start;
+  int n_managed;
 
+  start = g_get_monotonic_time ();
+  operation = meta_display_set_operation (screen->display, "manage-all-windows");
   meta_display_grab (screen->display);
   
   windows = list_windows (screen);
 
+  /* Ask for the properties of every window we may manage up front;
+   * the server stays grabbed, so the replies cannot go stale, and
+   * managing them all then waits for one round trip instead of one
+   * each
+   */
+  for (list = windows; list != NULL; list = list->next)
+    {
+      WindowInfo *info = list->data;
+
+      if (!info->attrs.override_redirect)
+        meta_window_prefetch_properties (screen->display, info->xwindow);
+    }
+
+  n_managed = 0;
   meta_stack_freeze (screen->stack);
   for (list = windows; list != NULL; list = list->next)
     {
@@ -779,6 +806,13 @@ meta_screen_manage_all_windows (MetaScreen *screen)
 
       window = meta_window_new_with_attrs (screen->display, info->xwindow, TRUE,
                                            &info->attrs);
+
+      /* For the ones it decided against early */
+      meta_prop_end_prefetch (screen->display, info->xwindow);
+
+      if (window != NULL)
+        n_managed++;
+
       if (info->xwindow == screen->no_focus_window ||
           info->xwindow == screen->flash_window ||
 #ifdef HAVE_COMPOSITE_EXTENSIONS
@@ -795,10 +829,16 @@ meta_screen_manage_all_windows (MetaScreen *screen)
     }
   meta_stack_thaw (screen->stack);
 
+  meta_topic (META_DEBUG_STARTUP,
+              "Screen %d ready: managed %d of %d windows in %.1f ms\n",
+              screen->number, n_managed, g_list_length (windows),
+              (g_get_monotonic_time () - start) / 1000.0);
+
   g_list_foreach (windows, (GFunc)g_free, NULL);
   g_list_free (windows);
 
   meta_display_ungrab (screen->display);
+  meta_display_set_operation (screen->display, operation);
 }
 
 void
@@ -1496,6 +1536,7 @@ meta_screen_get_mouse_window (MetaScreen  *screen,
                 "Focusing mouse window excluding %s\n", not_this_one->desc);
 
   meta_error_trap_push (screen->display);
+  meta_display_note_round_trip (screen->display);
   XQueryPointer (screen->display->xdisplay,
                  screen->xroot,
                  &root_return,
@@ -1707,6 +1748,7 @@ meta_screen_get_current_xinerama (MetaScreen *screen)
       screen->display->xinerama_cache_invalidated = FALSE;
       
       pointer_position.width = pointer_position.height = 1;
+      meta_display_note_round_trip (screen->display);
       XQueryPointer (screen->display->xdisplay,
                      screen->xroot,
                      &root_return,
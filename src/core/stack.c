@@ -964,6 +964,7 @@ raise_window_relative_to_managed_windows (MetaScreen *screen,
   
   meta_error_trap_push_with_return (screen->display);
   
+  meta_display_note_round_trip (screen->display);
   XQueryTree (screen->display->xdisplay,
               screen->xroot,
               &ignored1, &ignored2, &children, &n_children);
@@ -0,0 +1,342 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Metacity asynchronous request benchmark */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Times what managing windows asks of the server, made the way
+ * meta_window_new () makes it, one window after another, against the
+ * same requests pipelined over every window with async-request.c,
+ * and checks both see the same thing.
+ *
+ *   testasyncrequest [windows] [latency-ms]
+ *
+ * Each window costs two round trips made one after another: the
+ * attributes, then the initial properties.  Pipelined, all windows
+ * together cost one.  A local server hides the difference, so the
+ * times are also given as they would be with latency-ms (50 by
+ * default) added to every round trip; for the real thing, run it
+ * against a display reached over a slow link.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xatom.h>
+
+#include "async-request.h"
+#include "async-getprop.h"
+
+#define N_PROPS 6
+
+static const char *prop_names[N_PROPS] = {
+  "WM_NAME",
+  "WM_CLASS",
+  "WM_NORMAL_HINTS",
+  "WM_PROTOCOLS",
+  "_NET_WM_WINDOW_TYPE",
+  "_NET_WM_PID"
+};
+
+typedef struct
+{
+  XWindowAttributes attrs;
+  unsigned long     n_items[N_PROPS];
+} WindowInfo;
+
+static Atom props[N_PROPS];
+
+static Window*
+create_windows (Display *xdisplay,
+                int      n_windows)
+{
+  Window root = DefaultRootWindow (xdisplay);
+  Window *windows;
+  int i;
+
+  windows = g_new (Window, n_windows);
+
+  for (i = 0; i < n_windows; i++)
+    {
+      char *name;
+      long pid = i;
+
+      windows[i] = XCreateSimpleWindow (xdisplay, root,
+                                        i % 640, i % 480,
+                                        100 + i % 50, 100 + i % 70,
+                                        0, 0, 0);
+
+      name = g_strdup_printf ("testasyncrequest %d", i);
+      XStoreName (xdisplay, windows[i], name);
+      g_free (name);
+
+      XChangeProperty (xdisplay, windows[i], props[5], XA_CARDINAL, 32,
+                       PropModeReplace, (guchar *) &pid, 1);
+    }
+
+  XSync (xdisplay, False);
+
+  return windows;
+}
+
+static void
+get_props (Display    *xdisplay,
+           WindowInfo *info,
+           AgGetPropertyTask **tasks)
+{
+  int i;
+
+  for (i = 0; i < N_PROPS; i++)
+    {
+      Atom type;
+      int format;
+      unsigned long bytes_after;
+      guchar *data;
+
+      info->n_items[i] = 0;
+
+      if (tasks[i] != NULL &&
+          ag_task_get_reply_and_free (tasks[i], &type, &format,
+                                      &info->n_items[i], &bytes_after,
+                                      &data) == Success)
+        XFree (data);
+    }
+}
+
+/* One window after another, as meta_window_new () does */
+static guint
+manage_sync (Display    *xdisplay,
+             Window     *windows,
+             int         n_windows,
+             WindowInfo *infos)
+{
+  guint round_trips = 0;
+  int w, i;
+
+  for (w = 0; w < n_windows; w++)
+    {
+      AgGetPropertyTask *tasks[N_PROPS];
+
+      XGetWindowAttributes (xdisplay, windows[w], &infos[w].attrs);
+      round_trips++;
+
+      for (i = 0; i < N_PROPS; i++)
+        tasks[i] = ag_task_create (xdisplay, windows[w], props[i],
+                                   0, G_MAXLONG, False, AnyPropertyType);
+
+      XSync (xdisplay, False);
+      round_trips++;
+
+      get_props (xdisplay, &infos[w], tasks);
+    }
+
+  return round_trips;
+}
+
+/* Everything sent at once, then collected */
+static guint
+manage_async (Display    *xdisplay,
+              Window     *windows,
+              int         n_windows,
+              WindowInfo *infos)
+{
+  MetaAsyncRequest **requests;
+  AgGetPropertyTask **tasks;
+  guint waits;
+  int w, i;
+
+  requests = g_new (MetaAsyncRequest *, n_windows);
+  tasks = g_new (AgGetPropertyTask *, n_windows * N_PROPS);
+  waits = meta_async_request_get_n_waits ();
+
+  for (w = 0; w < n_windows; w++)
+    {
+      requests[w] = meta_async_get_window_attributes (xdisplay, windows[w]);
+
+      for (i = 0; i < N_PROPS; i++)
+        tasks[w * N_PROPS + i] =
+          ag_task_create (xdisplay, windows[w], props[i],
+                          0, G_MAXLONG, False, AnyPropertyType);
+    }
+
+  /* The first wait reads every reply */
+  for (w = 0; w < n_windows; w++)
+    {
+      meta_async_get_window_attributes_reply (requests[w], &infos[w].attrs);
+      get_props (xdisplay, &infos[w], &tasks[w * N_PROPS]);
+    }
+
+  g_free (requests);
+  g_free (tasks);
+
+  return meta_async_request_get_n_waits () - waits;
+}
+
+static int
+compare_infos (WindowInfo *a,
+               WindowInfo *b,
+               int         n_windows)
+{
+  int differences = 0;
+  int w;
+
+  for (w = 0; w < n_windows; w++)
+    {
+      if (a[w].attrs.x != b[w].attrs.x ||
+          a[w].attrs.y != b[w].attrs.y ||
+          a[w].attrs.width != b[w].attrs.width ||
+          a[w].attrs.height != b[w].attrs.height ||
+          a[w].attrs.map_state != b[w].attrs.map_state ||
+          a[w].attrs.override_redirect != b[w].attrs.override_redirect ||
+          a[w].attrs.visual != b[w].attrs.visual ||
+          a[w].attrs.screen != b[w].attrs.screen ||
+          memcmp (a[w].n_items, b[w].n_items, sizeof (a[w].n_items)) != 0)
+        differences++;
+    }
+
+  return differences;
+}
+
+static int
+check_query_tree (Display *xdisplay)
+{
+  Window root = DefaultRootWindow (xdisplay);
+  Window sync_root, sync_parent, *sync_children;
+  Window async_root, async_parent, *async_children;
+  unsigned int n_sync, n_async, i;
+  int differences = 0;
+
+  XQueryTree (xdisplay, root, &sync_root, &sync_parent,
+              &sync_children, &n_sync);
+  meta_async_query_tree_reply (meta_async_query_tree (xdisplay, root),
+                               &async_root, &async_parent,
+                               &async_children, &n_async);
+
+  if (sync_root != async_root || sync_parent != async_parent ||
+      n_sync != n_async)
+    differences++;
+  else
+    for (i = 0; i < n_sync; i++)
+      if (sync_children[i] != async_children[i])
+        differences++;
+
+  XFree (sync_children);
+  g_free (async_children);
+
+  return differences;
+}
+
+static int
+check_errors (Display *xdisplay,
+              Window   destroyed)
+{
+  XWindowAttributes attrs;
+  Window root;
+  int x, y;
+  unsigned int width, height, border_width, depth;
+  int differences = 0;
+
+  /* Errors go to the reply, not the error handler */
+  if (meta_async_get_window_attributes_reply (meta_async_get_window_attributes (xdisplay, destroyed),
+                                              &attrs) != BadWindow)
+    differences++;
+
+  if (meta_async_get_geometry_reply (meta_async_get_geometry (xdisplay, destroyed),
+                                     &root, &x, &y, &width, &height,
+                                     &border_width, &depth) != BadDrawable)
+    differences++;
+
+  /* A cancelled request's reply is still read */
+  meta_async_request_cancel (meta_async_query_tree (xdisplay, destroyed));
+  XSync (xdisplay, False);
+
+  return differences;
+}
+
+int
+main (int argc, char **argv)
+{
+  Display *xdisplay;
+  Window *windows;
+  WindowInfo *sync_infos, *async_infos;
+  int n_windows = 200;
+  int latency = 50;
+  guint sync_trips, async_trips;
+  gint64 start;
+  double sync_time, async_time;
+  int differences;
+  int i;
+
+  if (argc > 1)
+    n_windows = MAX (atoi (argv[1]), 1);
+  if (argc > 2)
+    latency = MAX (atoi (argv[2]), 0);
+
+  xdisplay = XOpenDisplay (NULL);
+  if (xdisplay == NULL)
+    {
+      g_printerr ("Could not open display\n");
+      return 1;
+    }
+
+  for (i = 0; i < N_PROPS; i++)
+    props[i] = XInternAtom (xdisplay, prop_names[i], False);
+
+  windows = create_windows (xdisplay, n_windows);
+  sync_infos = g_new0 (WindowInfo, n_windows);
+  async_infos = g_new0 (WindowInfo, n_windows);
+
+  start = g_get_monotonic_time ();
+  sync_trips = manage_sync (xdisplay, windows, n_windows, sync_infos);
+  sync_time = (g_get_monotonic_time () - start) / 1000.0;
+
+  start = g_get_monotonic_time ();
+  async_trips = manage_async (xdisplay, windows, n_windows, async_infos);
+  async_time = (g_get_monotonic_time () - start) / 1000.0;
+
+  g_print ("%d windows, %d properties each\n", n_windows, N_PROPS);
+  g_print ("%-10s %12s %12s %14s %14s\n",
+           "mode", "round trips", "ms", "ms at latency", "windows/s");
+  g_print ("%-10s %12u %12.2f %14.2f %14.0f\n", "sync",
+           sync_trips, sync_time, sync_time + sync_trips * latency,
+           n_windows * 1000.0 / (sync_time + sync_trips * latency));
+  g_print ("%-10s %12u %12.2f %14.2f %14.0f\n", "pipelined",
+           async_trips, async_time, async_time + async_trips * latency,
+           n_windows * 1000.0 / (async_time + async_trips * latency));
+
+  differences = compare_infos (sync_infos, async_infos, n_windows);
+  differences += check_query_tree (xdisplay);
+
+  XDestroyWindow (xdisplay, windows[0]);
+  differences += check_errors (xdisplay, windows[0]);
+
+  for (i = 1; i < n_windows; i++)
+    XDestroyWindow (xdisplay, windows[i]);
+
+  XCloseDisplay (xdisplay);
+
+  g_free (windows);
+  g_free (sync_infos);
+  g_free (async_infos);
+
+  if (differences > 0)
+    g_printerr ("%d results differ between sync and pipelined requests\n",
+                differences);
+
+  return differences > 0 ? 1 : 0;
+}
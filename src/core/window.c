@@ -202,7 +202,9 @@ meta_window_new (MetaDisplay *display,
 {
   XWindowAttributes attrs;
   MetaWindow *window;
+  const char *operation;
   
+  operation = meta_display_set_operation (display, "manage-window");
   meta_display_grab (display);
   meta_error_trap_push (display); /* Push a trap over all of window
                                    * creation, to reduce XSync() calls
@@ -210,6 +212,7 @@ meta_window_new (MetaDisplay *display,
   
   meta_error_trap_push_with_return (display);
   
+  meta_display_note_round_trip (display);
   if (XGetWindowAttributes (display->xdisplay,xwindow, &attrs)) 
    {
       if(meta_error_trap_pop_with_return (display, TRUE) != Success)
@@ -218,6 +221,7 @@ meta_window_new (MetaDisplay *display,
                         xwindow);
           meta_error_trap_pop (display, TRUE);
           meta_display_ungrab (display);
+          meta_display_set_operation (display, operation);
           return NULL;
        }
       window = meta_window_new_with_attrs (display, xwindow,
@@ -230,16 +234,59 @@ meta_window_new (MetaDisplay *display,
                         xwindow);
          meta_error_trap_pop (display, TRUE);
          meta_display_ungrab (display);
+         meta_display_set_operation (display, operation);
          return NULL;
    }
    
   
   meta_error_trap_pop (display, FALSE);
   meta_display_ungrab (display);
+  meta_display_set_operation (display, operation);
 
   return window;
 }
 
+/* Everything managing a window reads from the window itself, fetched
+ * together so that it takes one round trip however many there are
+ */
+void
+meta_window_prefetch_properties (MetaDisplay *display,
+                                 Window       xwindow)
+{
+  Atom atoms[] = {
+    display->atom_WM_STATE,
+    display->atom_WM_CLIENT_MACHINE,
+    display->atom__NET_WM_PID,
+    display->atom__NET_WM_NAME,
+    XA_WM_CLASS,
+    XA_WM_NAME,
+    display->atom__NET_WM_ICON_NAME,
+    XA_WM_ICON_NAME,
+    display->atom__NET_WM_DESKTOP,
+    display->atom__NET_STARTUP_ID,
+    display->atom__NET_WM_SYNC_REQUEST_COUNTER,
+    XA_WM_NORMAL_HINTS,
+    display->atom_WM_PROTOCOLS,
+    XA_WM_HINTS,
+    display->atom__NET_WM_USER_TIME,
+    display->atom__NET_WM_STATE,
+    display->atom__MOTIF_WM_HINTS,
+    XA_WM_TRANSIENT_FOR,
+    display->atom__NET_WM_USER_TIME_WINDOW,
+    display->atom__NET_WM_FULLSCREEN_MONITORS,
+    display->atom_WM_CLIENT_LEADER,
+    display->atom_SM_CLIENT_ID,
+    display->atom_WM_WINDOW_ROLE,
+    display->atom__NET_WM_WINDOW_TYPE,
+    display->atom__NET_WM_ICON,
+    display->atom__KWM_WIN_ICON,
+    display->atom__NET_WM_STRUT_PARTIAL,
+    display->atom__NET_WM_STRUT
+  };
+
+  meta_prop_prefetch (display, xwindow, atoms, G_N_ELEMENTS (atoms));
+}
+
 MetaWindow*
 meta_window_new_with_attrs (MetaDisplay       *display,
                             Window             xwindow,
@@ -281,6 +328,9 @@ meta_window_new_with_attrs (MetaDisplay       *display,
                                    * creation, to reduce XSync() calls
                                    */
 
+  /* Good for as long as the server is grabbed */
+  meta_window_prefetch_properties (display, xwindow);
+
   meta_verbose ("must_be_viewable = %d attrs->map_state = %d (%s)\n",
                 must_be_viewable,
                 attrs->map_state,
@@ -306,6 +356,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
             (state == IconicState || state == NormalState)))
         {
           meta_verbose ("Deciding not to manage unmapped or unviewable window 0x%lx\n", xwindow);
+          meta_prop_end_prefetch (display, xwindow);
           meta_error_trap_pop (display, TRUE);
           meta_display_ungrab (display);
           return NULL;
@@ -325,6 +376,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
     FocusChangeMask | ColormapChangeMask;
 
   XSelectInput (display->xdisplay, xwindow, event_mask);
+  meta_prop_cache_window (display, xwindow);
 
   has_shape = FALSE;
 #ifdef HAVE_SHAPE
@@ -336,6 +388,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
 
       XShapeSelectInput (display->xdisplay, xwindow, ShapeNotifyMask);
 
+      meta_display_note_round_trip (display);
       XShapeQueryExtents (display->xdisplay, xwindow,
                           &bounding_shaped, &x_bounding, &y_bounding,
                           &w_bounding, &h_bounding,
@@ -372,6 +425,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
     {
       meta_verbose ("Window 0x%lx disappeared just as we tried to manage it\n",
                     xwindow);
+      meta_prop_forget_window (display, xwindow);
       meta_error_trap_pop (display, FALSE);
       meta_display_ungrab (display);
       return NULL;
@@ -826,6 +880,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   if (!display->display_opening && !window->initially_iconic)
     unminimize_window_and_all_transient_parents (window);
 
+  meta_prop_end_prefetch (display, xwindow);
   meta_error_trap_pop (display, FALSE); /* pop the XSync()-reducing trap */
   meta_display_ungrab (display);
  
@@ -1154,7 +1209,7 @@ meta_window_free (MetaWindow  *window,
   meta_display_ungrab_focus_window_button (window->display, window);
   
   meta_display_unregister_x_window (window->display, window->xwindow);
-  
+  meta_prop_forget_window (window->display, window->xwindow);
 
   meta_error_trap_push (window->display);
 
@@ -5286,6 +5341,7 @@ meta_window_client_message (MetaWindow *window,
                */
               mask = 0;
               meta_error_trap_push (window->display);
+              meta_display_note_round_trip (window->display);
               XQueryPointer (window->display->xdisplay,
                              window->xwindow,
                              &root, &child,
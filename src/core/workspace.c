@@ -375,6 +375,7 @@ meta_workspace_activate_with_focus (MetaWorkspace *workspace,
 {
   MetaWorkspace *old;
   MetaWindow *move_window;
+  const char *operation;
   
   meta_verbose ("Activating workspace %d\n",
                 meta_workspace_index (workspace));
@@ -402,6 +403,9 @@ meta_workspace_activate_with_focus (MetaWorkspace *workspace,
   if (old == NULL)
     return;
 
+  operation = meta_display_set_operation (workspace->screen->display,
+                                          "switch-workspace");
+
   move_window = NULL;
   if (workspace->screen->display->grab_op == META_GRAB_OP_MOVING ||
       workspace->screen->display->grab_op == META_GRAB_OP_KEYBOARD_MOVING)
@@ -448,6 +452,8 @@ meta_workspace_activate_with_focus (MetaWorkspace *workspace,
       meta_topic (META_DEBUG_FOCUS, "Focusing default window on new workspace\n");
       meta_workspace_focus_default_window (workspace, NULL, timestamp);
     }
+
+  meta_display_set_operation (workspace->screen->display, operation);
 }
 
 void
@@ -175,6 +175,10 @@ validate_or_free_results (GetPropertyResults *results,
   return FALSE;
 }
 
+static gboolean cache_property (MetaDisplay *display,
+                                Window       xwindow,
+                                Atom         xatom);
+
 static gboolean
 get_property (MetaDisplay        *display,
               Window              xwindow,
@@ -190,8 +194,24 @@ get_property (MetaDisplay        *display,
   results->type = None;
   results->bytes_after = 0;
   results->format = 0;
-  
+
+  cache_property (display, xwindow, xatom);
+
+  if (meta_prop_get_prefetched (display, xwindow, xatom, req_type,
+                                &results->type, &results->format,
+                                &results->n_items, &results->bytes_after,
+                                &results->prop))
+    {
+      if (results->type != None)
+        return TRUE;
+
+      if (results->prop)
+        XFree (results->prop);
+      return FALSE;
+    }
+
   meta_error_trap_push_with_return (display);
+  meta_display_note_round_trip (display);
   if (XGetWindowProperty (display->xdisplay, xwindow, xatom,
                           0, G_MAXLONG,
                           False, req_type, &results->type, &results->format,
@@ -913,6 +933,436 @@ get_task (MetaDisplay        *display,
                          False, req_type);
 }
 
+typedef struct
+{
+  Atom               xatom;
+  AgGetPropertyTask *task;
+  /* The GetProperty request; a PropertyNotify with the same or a later
+   * serial was made after the server answered it
+   */
+  unsigned long      serial;
+  Atom               type;
+  int                format;
+  unsigned long      n_items;
+  unsigned long      bytes_after;
+  unsigned char     *prop;
+} StoredProperty;
+
+typedef struct
+{
+  /* StoredProperty pointers */
+  GPtrArray *props;
+  /* Between meta_prop_prefetch () and meta_prop_end_prefetch () */
+  gboolean   prefetching;
+  /* Kept up to date by meta_prop_invalidate () */
+  gboolean   cached;
+} StoredWindow;
+
+/* Values bigger than this, icons mostly, are not kept once the window
+ * is managed
+ */
+#define MAX_CACHED_SIZE 4096
+
+/* StoredWindows by window */
+static GHashTable *stored_windows = NULL;
+/* The properties whose task is outstanding, in request order, which
+ * is the order async-getprop.c completes them in and can free them
+ * cheaply in
+ */
+static GQueue fetches_outstanding = G_QUEUE_INIT;
+
+static guint cache_hits = 0;
+static guint cache_misses = 0;
+
+static void
+collect_property (StoredProperty *p)
+{
+  if (p->task == NULL)
+    return;
+
+  g_assert (ag_task_have_reply (p->task));
+
+  /* A failed request is kept with type None so that it is not
+   * asked again
+   */
+  if (ag_task_get_reply_and_free (p->task, &p->type, &p->format,
+                                  &p->n_items, &p->bytes_after,
+                                  &p->prop) != Success)
+    {
+      p->type = None;
+      p->prop = NULL;
+    }
+
+  p->task = NULL;
+}
+
+/* Collects every outstanding property and nothing else, in one round
+ * trip unless the replies have all been read already
+ */
+static void
+collect_stored (MetaDisplay *display)
+{
+  StoredProperty *p;
+
+  p = g_queue_peek_tail (&fetches_outstanding);
+  if (p == NULL)
+    return;
+
+  /* Replies come in request order, so if the last is in, all are */
+  if (!ag_task_have_reply (p->task))
+    {
+      meta_topic (META_DEBUG_SYNC, "Syncing to get %u stored properties\n",
+                  g_queue_get_length (&fetches_outstanding));
+      meta_display_note_round_trip (display);
+      XSync (display->xdisplay, False);
+    }
+
+  while ((p = g_queue_pop_head (&fetches_outstanding)) != NULL)
+    collect_property (p);
+}
+
+static StoredWindow*
+lookup_stored_window (Window xwindow)
+{
+  if (stored_windows == NULL)
+    return NULL;
+
+  return g_hash_table_lookup (stored_windows, GSIZE_TO_POINTER (xwindow));
+}
+
+static StoredWindow*
+ensure_stored_window (Window xwindow)
+{
+  StoredWindow *sw;
+
+  if (stored_windows == NULL)
+    stored_windows = g_hash_table_new (NULL, NULL);
+
+  sw = lookup_stored_window (xwindow);
+  if (sw == NULL)
+    {
+      sw = g_new0 (StoredWindow, 1);
+      sw->props = g_ptr_array_new ();
+      g_hash_table_insert (stored_windows, GSIZE_TO_POINTER (xwindow), sw);
+    }
+
+  return sw;
+}
+
+static int
+find_stored_index (StoredWindow *sw,
+                   Atom          xatom)
+{
+  guint i;
+
+  for (i = 0; i < sw->props->len; i++)
+    if (((StoredProperty *) g_ptr_array_index (sw->props, i))->xatom == xatom)
+      return i;
+
+  return -1;
+}
+
+static StoredProperty*
+find_stored (MetaDisplay *display,
+             Window       xwindow,
+             Atom         xatom)
+{
+  StoredWindow *sw;
+  StoredProperty *p;
+  int i;
+
+  sw = lookup_stored_window (xwindow);
+  if (sw == NULL)
+    return NULL;
+
+  i = find_stored_index (sw, xatom);
+  if (i < 0)
+    return NULL;
+
+  p = g_ptr_array_index (sw->props, i);
+  if (p->task != NULL)
+    collect_stored (display);
+
+  return p;
+}
+
+static gsize
+stored_size (StoredProperty *p)
+{
+  /* Format 32 comes as longs, as XGetWindowProperty () gives it */
+  switch (p->format)
+    {
+    case 8:
+      return p->n_items;
+    case 16:
+      return p->n_items * sizeof (short);
+    default:
+      return p->n_items * sizeof (long);
+    }
+}
+
+static void
+remove_stored (StoredWindow *sw,
+               int           i)
+{
+  StoredProperty *p = g_ptr_array_index (sw->props, i);
+
+  g_assert (p->task == NULL);
+
+  if (p->prop)
+    XFree (p->prop);
+
+  g_free (p);
+  g_ptr_array_remove_index_fast (sw->props, i);
+}
+
+/* Asks for each property not stored yet, without waiting */
+static void
+fetch_properties (MetaDisplay  *display,
+                  StoredWindow *sw,
+                  Window        xwindow,
+                  const Atom   *atoms,
+                  int           n_atoms)
+{
+  int i;
+
+  for (i = 0; i < n_atoms; i++)
+    {
+      StoredProperty *p;
+      unsigned long serial;
+      AgGetPropertyTask *task;
+
+      if (find_stored_index (sw, atoms[i]) >= 0)
+        continue;
+
+      serial = NextRequest (display->xdisplay);
+      task = get_task (display, xwindow, atoms[i], AnyPropertyType);
+      if (task == NULL)
+        continue;
+
+      p = g_new0 (StoredProperty, 1);
+      p->xatom = atoms[i];
+      p->serial = serial;
+      p->task = task;
+      p->type = None;
+
+      g_ptr_array_add (sw->props, p);
+      g_queue_push_tail (&fetches_outstanding, p);
+    }
+}
+
+/* For a cached window, makes sure the property is stored, counting
+ * whether it already was; returns whether the window is cached
+ */
+static gboolean
+cache_property (MetaDisplay *display,
+                Window       xwindow,
+                Atom         xatom)
+{
+  StoredWindow *sw;
+
+  sw = lookup_stored_window (xwindow);
+  if (sw == NULL || !sw->cached)
+    return FALSE;
+
+  if (find_stored_index (sw, xatom) >= 0)
+    {
+      cache_hits++;
+    }
+  else
+    {
+      cache_misses++;
+      fetch_properties (display, sw, xwindow, &xatom, 1);
+    }
+
+  return TRUE;
+}
+
+static void
+free_stored_window (MetaDisplay  *display,
+                    Window        xwindow,
+                    StoredWindow *sw)
+{
+  guint i;
+
+  /* Replies still on their way must be read before their tasks go */
+  for (i = 0; i < sw->props->len; i++)
+    if (((StoredProperty *) g_ptr_array_index (sw->props, i))->task != NULL)
+      {
+        collect_stored (display);
+        break;
+      }
+
+  while (sw->props->len > 0)
+    remove_stored (sw, sw->props->len - 1);
+
+  g_hash_table_remove (stored_windows, GSIZE_TO_POINTER (xwindow));
+  g_ptr_array_free (sw->props, TRUE);
+  g_free (sw);
+}
+
+void
+meta_prop_prefetch (MetaDisplay *display,
+                    Window       xwindow,
+                    const Atom  *atoms,
+                    int          n_atoms)
+{
+  StoredWindow *sw;
+
+  sw = ensure_stored_window (xwindow);
+  sw->prefetching = TRUE;
+
+  fetch_properties (display, sw, xwindow, atoms, n_atoms);
+}
+
+void
+meta_prop_end_prefetch (MetaDisplay *display,
+                        Window       xwindow)
+{
+  StoredWindow *sw;
+  int i;
+
+  sw = lookup_stored_window (xwindow);
+  if (sw == NULL)
+    return;
+
+  if (!sw->cached)
+    {
+      free_stored_window (display, xwindow, sw);
+      return;
+    }
+
+  sw->prefetching = FALSE;
+
+  collect_stored (display);
+
+  for (i = sw->props->len - 1; i >= 0; i--)
+    if (stored_size (g_ptr_array_index (sw->props, i)) > MAX_CACHED_SIZE)
+      remove_stored (sw, i);
+}
+
+void
+meta_prop_cache_window (MetaDisplay *display,
+                        Window       xwindow)
+{
+  ensure_stored_window (xwindow)->cached = TRUE;
+}
+
+void
+meta_prop_forget_window (MetaDisplay *display,
+                         Window       xwindow)
+{
+  StoredWindow *sw;
+
+  sw = lookup_stored_window (xwindow);
+  if (sw != NULL)
+    free_stored_window (display, xwindow, sw);
+}
+
+void
+meta_prop_invalidate (MetaDisplay   *display,
+                      Window         xwindow,
+                      Atom           xatom,
+                      unsigned long  serial)
+{
+  StoredWindow *sw;
+  StoredProperty *p;
+  int i;
+
+  sw = lookup_stored_window (xwindow);
+  if (sw == NULL)
+    return;
+
+  i = find_stored_index (sw, xatom);
+  if (i < 0)
+    return;
+
+  /* Asked after the change, so the value already has it */
+  p = g_ptr_array_index (sw->props, i);
+  if (serial < p->serial)
+    return;
+
+  /* The reply came before the event, so collecting needs no wait */
+  if (p->task != NULL)
+    collect_stored (display);
+
+  meta_topic (META_DEBUG_SYNC, "Dropping stored property %lu of 0x%lx\n",
+              xatom, xwindow);
+
+  remove_stored (sw, i);
+}
+
+void
+meta_prop_get_cache_stats (guint *hits,
+                           guint *misses)
+{
+  *hits = cache_hits;
+  *misses = cache_misses;
+}
+
+gboolean
+meta_prop_get_prefetched (MetaDisplay    *display,
+                          Window          xwindow,
+                          Atom            xatom,
+                          Atom            req_type,
+                          Atom           *type,
+                          int            *format,
+                          unsigned long  *n_items,
+                          unsigned long  *bytes_after,
+                          unsigned char **prop)
+{
+  StoredWindow *sw;
+  StoredProperty *p;
+  gsize size;
+
+  p = find_stored (display, xwindow, xatom);
+  if (p == NULL)
+    return FALSE;
+
+  *type = p->type;
+  *format = p->format;
+  *n_items = 0;
+  *bytes_after = 0;
+  *prop = NULL;
+
+  if (p->type == None)
+    {
+      *format = 0;
+      return TRUE;
+    }
+
+  /* It was fetched as AnyPropertyType; with the wrong type, the
+   * server gives back only the actual type, format and length
+   */
+  if (req_type != AnyPropertyType && req_type != p->type)
+    {
+      *bytes_after = p->n_items * (p->format / 8) + p->bytes_after;
+      return TRUE;
+    }
+
+  size = stored_size (p);
+
+  *prop = ag_Xmalloc (size + 1);
+  if (*prop == NULL)
+    {
+      *type = None;
+      return TRUE;
+    }
+
+  memcpy (*prop, p->prop, size);
+  (*prop)[size] = '\0';
+
+  *n_items = p->n_items;
+  *bytes_after = p->bytes_after;
+
+  /* A big value read by a cached window is not kept */
+  sw = lookup_stored_window (xwindow);
+  if (sw->cached && !sw->prefetching && size > MAX_CACHED_SIZE)
+    remove_stored (sw, find_stored_index (sw, xatom));
+
+  return TRUE;
+}
+
 static char*
 latin1_to_utf8 (const char *text)
 {
@@ -938,7 +1388,9 @@ meta_prop_get_values (MetaDisplay   *display,
                       int            n_values)
 {
   int i;
+  int n_tasks;
   AgGetPropertyTask **tasks;
+  gboolean *prefetched;
 
   meta_verbose ("Requesting %d properties of 0x%lx at once\n",
                 n_values, xwindow);
@@ -947,6 +1399,8 @@ meta_prop_get_values (MetaDisplay   *display,
     return;
   
   tasks = g_new0 (AgGetPropertyTask*, n_values);
+  prefetched = g_new0 (gboolean, n_values);
+  n_tasks = 0;
 
   /* Start up tasks. The "values" array can have values
    * with atom == None, which means to ignore that element.
@@ -1004,17 +1458,29 @@ meta_prop_get_values (MetaDisplay   *display,
             }
         }
 
-      if (values[i].atom != None)
-        tasks[i] = get_task (display, xwindow,
-                             values[i].atom, values[i].required_type);
+      if (values[i].atom != None &&
+          (cache_property (display, xwindow, values[i].atom) ||
+           find_stored (display, xwindow, values[i].atom) != NULL))
+        prefetched[i] = TRUE;
+      else if (values[i].atom != None)
+        {
+          tasks[i] = get_task (display, xwindow,
+                               values[i].atom, values[i].required_type);
+          n_tasks++;
+        }
       
       ++i;
     }  
   
   /* Get replies for all our tasks */
-  meta_topic (META_DEBUG_SYNC, "Syncing to get %d GetProperty replies in %s\n",
-              n_values, G_STRFUNC);
-  XSync (display->xdisplay, False);
+  if (n_tasks > 0)
+    {
+      meta_topic (META_DEBUG_SYNC,
+                  "Syncing to get %d GetProperty replies in %s\n",
+                  n_tasks, G_STRFUNC);
+      meta_display_note_round_trip (display);
+      XSync (display->xdisplay, False);
+    }
   
   /* Collect results, should arrive in order requested */
   i = 0;
@@ -1023,6 +1489,25 @@ meta_prop_get_values (MetaDisplay   *display,
       AgGetPropertyTask *task;
       GetPropertyResults results;
       
+      results.display = display;
+      results.xwindow = xwindow;
+      results.xatom = values[i].atom;
+      results.prop = NULL;
+      results.n_items = 0;
+      results.type = None;
+      results.bytes_after = 0;
+      results.format = 0;
+
+      if (prefetched[i])
+        {
+          meta_prop_get_prefetched (display, xwindow, values[i].atom,
+                                    values[i].required_type,
+                                    &results.type, &results.format,
+                                    &results.n_items, &results.bytes_after,
+                                    &results.prop);
+          goto have_results;
+        }
+
       if (tasks[i] == NULL)
         {
           /* Probably values[i].type was None, or ag_task_create()
@@ -1032,25 +1517,21 @@ meta_prop_get_values (MetaDisplay   *display,
           goto next;
         }
       
-      task = ag_get_next_completed_task (display->xdisplay);
-      g_assert (task != NULL);
+      /* Prefetched replies may be completed but not collected yet,
+       * so take ours by task rather than in order
+       */
+      task = tasks[i];
       g_assert (ag_task_have_reply (task));
 
-      results.display = display;
-      results.xwindow = xwindow;
-      results.xatom = values[i].atom;
-      results.prop = NULL;
-      results.n_items = 0;
-      results.type = None;
-      results.bytes_after = 0;
-      results.format = 0;
-      
       if (ag_task_get_reply_and_free (task,
                                       &results.type, &results.format,
                                       &results.n_items,
                                       &results.bytes_after,
-                                      &results.prop) != Success ||
-          results.type == None)
+                                      &results.prop) != Success)
+        results.type = None;
+
+    have_results:
+      if (results.type == None)
         {
           values[i].type = META_PROP_VALUE_INVALID;
           if (results.prop)
@@ -1170,6 +1651,7 @@ meta_prop_get_values (MetaDisplay   *display,
     }
 
   g_free (tasks);
+  g_free (prefetched);
 }
 
 static void
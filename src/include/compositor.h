@@ -53,6 +53,13 @@ Pixmap meta_compositor_get_window_pixmap (MetaCompositor *compositor,
 void meta_compositor_set_active_window (MetaCompositor *compositor,
                                         MetaScreen     *screen,
                                         MetaWindow     *window);
+void meta_compositor_publish_stats (MetaCompositor *compositor);
+Pixmap meta_compositor_get_window_thumbnail (MetaCompositor *compositor,
+                                             MetaWindow     *window,
+                                             int             max_width,
+                                             int             max_height,
+                                             int            *width,
+                                             int            *height);
 
 void meta_compositor_begin_move (MetaCompositor *compositor,
                                  MetaWindow *window,
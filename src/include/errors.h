@@ -41,9 +41,32 @@ void      meta_error_trap_pop  (MetaDisplay *display,
                                 gboolean     last_request_was_roundtrip);
 
 void      meta_error_trap_push_with_return (MetaDisplay *display);
-/* returns X error code, or 0 for no error */
-int       meta_error_trap_pop_with_return  (MetaDisplay *display,
-                                            gboolean     last_request_was_roundtrip);
+/* returns X error code, or 0 for no error; this waits for the server,
+ * so the round trip is counted against the caller
+ */
+int       meta_error_trap_pop_with_return_at (MetaDisplay *display,
+                                              gboolean     last_request_was_roundtrip,
+                                              const char  *location);
+#define meta_error_trap_pop_with_return(display, last_request_was_roundtrip) \
+  meta_error_trap_pop_with_return_at ((display), (last_request_was_roundtrip), \
+                                      G_STRLOC)
+
+/* Called from the main loop with the error code if the server
+ * reports an error for a request made inside a deferred trap; never
+ * called if there was none.  Either way destroy is then called on data.
+ */
+typedef void (* MetaErrorTrapFunc) (MetaDisplay *display,
+                                    int          error_code,
+                                    gpointer     data);
+
+/* A trap which does not wait for the server when popped: errors are
+ * matched to it by request serial as they come in
+ */
+void      meta_error_trap_push_deferred (MetaDisplay       *display);
+void      meta_error_trap_pop_deferred  (MetaDisplay       *display,
+                                         MetaErrorTrapFunc  func,
+                                         gpointer           data,
+                                         GDestroyNotify     destroy);
 
 
 #endif
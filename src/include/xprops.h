@@ -218,6 +218,56 @@ void meta_prop_get_values (MetaDisplay   *display,
 void meta_prop_free_values (MetaPropValue *values,
                             int            n_values);
 
+/* Asks for the given properties of xwindow without waiting.  The
+ * first time one is needed, the replies for every window prefetched
+ * so far are read in one round trip, and until
+ * meta_prop_end_prefetch () for the window the meta_prop_get_*
+ * functions answer from them rather than asking the server again.
+ * Only for while the server is grabbed, so the properties cannot
+ * change underneath, unless the window is cached.
+ */
+void     meta_prop_prefetch       (MetaDisplay   *display,
+                                   Window         xwindow,
+                                   const Atom    *atoms,
+                                   int            n_atoms);
+void     meta_prop_end_prefetch   (MetaDisplay   *display,
+                                   Window         xwindow);
+
+/* Keeps the properties of xwindow, which must have PropertyChangeMask
+ * selected, once read, until meta_prop_invalidate () is given a
+ * PropertyNotify for them; after that the meta_prop_get_* functions
+ * only ask the server for what changed.  Big values are not kept.
+ * Forgotten with meta_prop_forget_window ().
+ */
+void     meta_prop_cache_window   (MetaDisplay   *display,
+                                   Window         xwindow);
+void     meta_prop_forget_window  (MetaDisplay   *display,
+                                   Window         xwindow);
+/* Called for every PropertyNotify, with the event's serial */
+void     meta_prop_invalidate     (MetaDisplay   *display,
+                                   Window         xwindow,
+                                   Atom           xatom,
+                                   unsigned long  serial);
+/* How many reads of cached windows were answered without and with
+ * asking the server
+ */
+void     meta_prop_get_cache_stats (guint        *hits,
+                                    guint        *misses);
+
+/* If the property was prefetched or cached, answers as XGetWindowProperty ()
+ * would for the whole of it and returns TRUE; a failed request comes
+ * back as type None.  The data is freed with XFree ().
+ */
+gboolean meta_prop_get_prefetched (MetaDisplay    *display,
+                                   Window          xwindow,
+                                   Atom            xatom,
+                                   Atom            req_type,
+                                   Atom           *type,
+                                   int            *format,
+                                   unsigned long  *n_items,
+                                   unsigned long  *bytes_after,
+                                   unsigned char **prop);
+
 #endif
 
 
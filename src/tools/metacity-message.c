@@ -170,11 +170,77 @@ send_toggle_verbose (void)
 }
 #endif
 
+/* Asks Metacity to publish statistics on the root window with the
+   given message and prints them once they show up there */
+static gboolean
+print_stats (const char *message_name,
+             const char *stats_name,
+             const char *no_answer)
+{
+  Display *xdisplay = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+  Window xroot = gdk_x11_get_default_root_xwindow ();
+  Atom stats_atom, utf8_string, type;
+  XEvent xev;
+  int format, waited;
+  unsigned long n_items, bytes_after;
+  unsigned char *data;
+
+  stats_atom = XInternAtom (xdisplay, stats_name, False);
+  utf8_string = XInternAtom (xdisplay, "UTF8_STRING", False);
+
+  XSelectInput (xdisplay, xroot, PropertyChangeMask);
+  XDeleteProperty (xdisplay, xroot, stats_atom);
+
+  xev.xclient.type = ClientMessage;
+  xev.xclient.serial = 0;
+  xev.xclient.send_event = True;
+  xev.xclient.display = xdisplay;
+  xev.xclient.window = xroot;
+  xev.xclient.message_type = XInternAtom (xdisplay, message_name, False);
+  xev.xclient.format = 32;
+  xev.xclient.data.l[0] = 0;
+  xev.xclient.data.l[1] = 0;
+  xev.xclient.data.l[2] = 0;
+
+  XSendEvent (xdisplay, xroot, False,
+              SubstructureRedirectMask | SubstructureNotifyMask,
+              &xev);
+  XSync (xdisplay, False);
+
+  /* Give the window manager a couple of seconds to answer */
+  for (waited = 0; waited < 2000; waited += 10)
+    {
+      if (XCheckTypedWindowEvent (xdisplay, xroot, PropertyNotify, &xev) &&
+          xev.xproperty.atom == stats_atom &&
+          xev.xproperty.state == PropertyNewValue)
+        break;
+
+      g_usleep (10 * 1000);
+    }
+
+  if (waited >= 2000)
+    {
+      g_printerr ("%s", no_answer);
+      return FALSE;
+    }
+
+  if (XGetWindowProperty (xdisplay, xroot, stats_atom, 0, G_MAXLONG, False,
+                          utf8_string, &type, &format, &n_items,
+                          &bytes_after, &data) != Success ||
+      type != utf8_string)
+    return FALSE;
+
+  g_print ("%s", (char *) data);
+  XFree (data);
+
+  return TRUE;
+}
+
 static void
 usage (void)
 {
   g_printerr (_("Usage: %s\n"),
-              "metacity-message (restart|reload-theme|enable-keybindings|disable-keybindings|enable-mouse-button-modifiers|disable-mouse-button-modifiers|toggle-verbose)");
+              "metacity-message (restart|reload-theme|enable-keybindings|disable-keybindings|enable-mouse-button-modifiers|disable-mouse-button-modifiers|toggle-verbose|compositor-stats|event-stats)");
   exit (1);
 }
 
@@ -209,6 +275,20 @@ main (int argc, char **argv)
       send_toggle_verbose ();
 #endif
     }
+  else if (strcmp (argv[1], "compositor-stats") == 0)
+    {
+      if (!print_stats ("_METACITY_COMPOSITOR_STATS_MESSAGE",
+                        "_METACITY_COMPOSITOR_STATS",
+                        _("Metacity did not answer; is the compositor enabled?\n")))
+        return 1;
+    }
+  else if (strcmp (argv[1], "event-stats") == 0)
+    {
+      if (!print_stats ("_METACITY_EVENT_STATS_MESSAGE",
+                        "_METACITY_EVENT_STATS",
+                        _("Metacity did not answer; is it running?\n")))
+        return 1;
+    }
   else
     usage ();
   
@@ -0,0 +1,803 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Replays compositor traces */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Metacity records what its compositor does to the file named by
+ * METACITY_COMPOSITOR_RECORD.  This replays such a trace with
+ * synthetic windows, so that compositor changes can be benchmarked
+ * against a real session:
+ *
+ *   compositor-replay --xvfb [--speed N] [--frames] TRACE
+ *       starts Xvfb and a compositing metacity, replays the trace into
+ *       them and reports how long metacity took to paint each frame
+ *
+ *   compositor-replay [--speed N] TRACE
+ *       replays into $DISPLAY
+ *
+ *   compositor-replay --report [--frames] TRACE
+ *       reports the paint times recorded in a trace
+ *
+ * A trace has one record per line, lines starting with # are comments.
+ * Every record starts with the microseconds since the previous one and
+ * a letter saying what happened; windows are X ids in hex:
+ *
+ *   S screen width height        a screen started being composited
+ *   C window x y width height border override-redirect argb screen
+ *                                a window was added
+ *   M window                     mapped
+ *   U window                     unmapped
+ *   X window                     destroyed
+ *   G window x y width height border above
+ *                                configured, above is 0 for the bottom
+ *   R window above               circulated
+ *   P window opacity             _NET_WM_WINDOW_OPACITY changed
+ *   D window n x y width height ...
+ *                                n damaged rectangles, relative to the
+ *                                window
+ *   B screen                     the background changed
+ *   F screen paint-us pixels painted culled
+ *                                a frame was painted, taking paint-us
+ *                                to issue, covering that many pixels
+ *                                and painting and culling that many
+ *                                windows
+ *
+ * The windows replayed are override redirect, so that the window
+ * manager leaves them alone and the compositor sees them where the
+ * frames of managed windows were.  Only the first screen is replayed.
+ */
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <glib.h>
+
+typedef struct
+{
+  Window xwindow;
+  GC gc;
+  guint damage_count;
+} ReplayWindow;
+
+typedef struct
+{
+  Display *xdisplay;
+  Window root;
+  int screen_number;
+  /* The first screen in the trace, the only one replayed */
+  int trace_screen;
+
+  /* Trace window ids to the windows standing in for them */
+  GHashTable *windows;
+
+  Atom atom_opacity;
+  Atom atom_root_pixmap;
+  Atom atom_set_root;
+  Pixmap background;
+  guint background_count;
+} Replay;
+
+static double speed = 1.0;
+static gboolean use_xvfb = FALSE;
+static gboolean report_only = FALSE;
+static gboolean show_frames = FALSE;
+static char *metacity_path = NULL;
+
+static GOptionEntry options[] = {
+  { "speed", 's', 0, G_OPTION_ARG_DOUBLE, &speed,
+    "Replay N times faster than recorded", "N" },
+  { "xvfb", 'x', 0, G_OPTION_ARG_NONE, &use_xvfb,
+    "Replay into a new Xvfb running metacity and report its frames", NULL },
+  { "metacity", 'm', 0, G_OPTION_ARG_FILENAME, &metacity_path,
+    "The metacity to run with --xvfb", "PATH" },
+  { "report", 'r', 0, G_OPTION_ARG_NONE, &report_only,
+    "Only report the frames recorded in the trace", NULL },
+  { "frames", 'f', 0, G_OPTION_ARG_NONE, &show_frames,
+    "List every frame in the report", NULL },
+  { NULL }
+};
+
+static Window
+parse_window (const char *field)
+{
+  return (Window) g_ascii_strtoull (field, NULL, 16);
+}
+
+static int
+parse_int (const char *field)
+{
+  return (int) g_ascii_strtoll (field, NULL, 10);
+}
+
+static ReplayWindow *
+lookup_window (Replay     *replay,
+               const char *field)
+{
+  return g_hash_table_lookup (replay->windows,
+                              GSIZE_TO_POINTER (parse_window (field)));
+}
+
+static void
+replay_create (Replay  *replay,
+               char   **fields)
+{
+  XSetWindowAttributes attrs;
+  unsigned long mask;
+  ReplayWindow *rw;
+  XVisualInfo vinfo;
+  Visual *visual = CopyFromParent;
+  int depth = CopyFromParent;
+  Window id = parse_window (fields[2]);
+
+  attrs.override_redirect = True;
+  attrs.background_pixel = (id * 2654435761u) & 0xffffff;
+  attrs.border_pixel = 0;
+  mask = CWOverrideRedirect | CWBackPixel | CWBorderPixel;
+
+  if (parse_int (fields[9]) &&
+      XMatchVisualInfo (replay->xdisplay, replay->screen_number, 32,
+                        TrueColor, &vinfo))
+    {
+      visual = vinfo.visual;
+      depth = vinfo.depth;
+      attrs.colormap = XCreateColormap (replay->xdisplay, replay->root,
+                                        visual, AllocNone);
+      attrs.background_pixel |= 0x80000000;
+      mask |= CWColormap;
+    }
+
+  rw = g_new0 (ReplayWindow, 1);
+  rw->xwindow = XCreateWindow (replay->xdisplay, replay->root,
+                               parse_int (fields[3]), parse_int (fields[4]),
+                               MAX (parse_int (fields[5]), 1),
+                               MAX (parse_int (fields[6]), 1),
+                               parse_int (fields[7]), depth, InputOutput,
+                               visual, mask, &attrs);
+  rw->gc = XCreateGC (replay->xdisplay, rw->xwindow, 0, NULL);
+
+  g_hash_table_replace (replay->windows, GSIZE_TO_POINTER (id), rw);
+}
+
+static void
+replay_configure (Replay       *replay,
+                  ReplayWindow *rw,
+                  char        **fields)
+{
+  XWindowChanges changes;
+  unsigned int mask;
+  Window above = parse_window (fields[8]);
+
+  changes.x = parse_int (fields[3]);
+  changes.y = parse_int (fields[4]);
+  changes.width = MAX (parse_int (fields[5]), 1);
+  changes.height = MAX (parse_int (fields[6]), 1);
+  changes.border_width = parse_int (fields[7]);
+  mask = CWX | CWY | CWWidth | CWHeight | CWBorderWidth;
+
+  if (above == None)
+    {
+      changes.stack_mode = Below;
+      mask |= CWStackMode;
+    }
+  else
+    {
+      ReplayWindow *sibling = g_hash_table_lookup (replay->windows,
+                                                   GSIZE_TO_POINTER (above));
+
+      /* Windows the compositor doesn't know about leave no trace */
+      if (sibling != NULL)
+        {
+          changes.sibling = sibling->xwindow;
+          changes.stack_mode = Above;
+          mask |= CWSibling | CWStackMode;
+        }
+    }
+
+  XConfigureWindow (replay->xdisplay, rw->xwindow, mask, &changes);
+}
+
+static void
+replay_damage (Replay       *replay,
+               ReplayWindow *rw,
+               char        **fields,
+               guint         n_fields)
+{
+  int n_rects = MIN (parse_int (fields[3]), (int) (n_fields - 4) / 4);
+  int i;
+
+  /* Change the colour every time, though any drawing is damage */
+  XSetForeground (replay->xdisplay, rw->gc,
+                  (++rw->damage_count * 0x10101) & 0xffffff);
+
+  for (i = 0; i < n_rects; i++)
+    {
+      char **rect = fields + 4 + i * 4;
+
+      XFillRectangle (replay->xdisplay, rw->xwindow, rw->gc,
+                      parse_int (rect[0]), parse_int (rect[1]),
+                      parse_int (rect[2]), parse_int (rect[3]));
+    }
+}
+
+static void
+replay_background (Replay *replay)
+{
+  Pixmap pixmap;
+  GC gc;
+  int width = DisplayWidth (replay->xdisplay, replay->screen_number);
+  int height = DisplayHeight (replay->xdisplay, replay->screen_number);
+
+  pixmap = XCreatePixmap (replay->xdisplay, replay->root, width, height,
+                          DefaultDepth (replay->xdisplay,
+                                        replay->screen_number));
+  gc = XCreateGC (replay->xdisplay, pixmap, 0, NULL);
+  XSetForeground (replay->xdisplay, gc,
+                  (++replay->background_count * 0x204080) & 0xffffff);
+  XFillRectangle (replay->xdisplay, pixmap, gc, 0, 0, width, height);
+  XFreeGC (replay->xdisplay, gc);
+
+  /* Like background setters, point both properties at the new pixmap */
+  XChangeProperty (replay->xdisplay, replay->root, replay->atom_root_pixmap,
+                   XA_PIXMAP, 32, PropModeReplace,
+                   (unsigned char *) &pixmap, 1);
+  XChangeProperty (replay->xdisplay, replay->root, replay->atom_set_root,
+                   XA_PIXMAP, 32, PropModeReplace,
+                   (unsigned char *) &pixmap, 1);
+
+  if (replay->background != None)
+    XFreePixmap (replay->xdisplay, replay->background);
+  replay->background = pixmap;
+}
+
+static void
+replay_record (Replay  *replay,
+               char   **fields)
+{
+  ReplayWindow *rw = NULL;
+  guint n_fields = g_strv_length (fields);
+
+  /* All the window records have the window next */
+  if (strchr ("MUXGRPD", fields[1][0]) != NULL)
+    {
+      if (n_fields < 3)
+        return;
+
+      rw = lookup_window (replay, fields[2]);
+      if (rw == NULL)
+        return;
+    }
+
+  switch (fields[1][0])
+    {
+    case 'S':
+      if (n_fields >= 3 && replay->trace_screen < 0)
+        replay->trace_screen = parse_int (fields[2]);
+      break;
+
+    case 'C':
+      /* Traces from before the screen was recorded have only one */
+      if (n_fields >= 10 &&
+          (n_fields < 11 || parse_int (fields[10]) == replay->trace_screen))
+        replay_create (replay, fields);
+      break;
+
+    case 'M':
+      XMapWindow (replay->xdisplay, rw->xwindow);
+      break;
+
+    case 'U':
+      XUnmapWindow (replay->xdisplay, rw->xwindow);
+      break;
+
+    case 'X':
+      XFreeGC (replay->xdisplay, rw->gc);
+      XDestroyWindow (replay->xdisplay, rw->xwindow);
+      g_hash_table_remove (replay->windows,
+                           GSIZE_TO_POINTER (parse_window (fields[2])));
+      break;
+
+    case 'G':
+      if (n_fields >= 9)
+        replay_configure (replay, rw, fields);
+      break;
+
+    case 'R':
+      if (n_fields >= 4)
+        {
+          if (parse_window (fields[3]) != None)
+            XRaiseWindow (replay->xdisplay, rw->xwindow);
+          else
+            XLowerWindow (replay->xdisplay, rw->xwindow);
+        }
+      break;
+
+    case 'P':
+      if (n_fields >= 4)
+        {
+          gulong opacity = g_ascii_strtoull (fields[3], NULL, 10);
+
+          XChangeProperty (replay->xdisplay, rw->xwindow,
+                           replay->atom_opacity, XA_CARDINAL, 32,
+                           PropModeReplace, (unsigned char *) &opacity, 1);
+        }
+      break;
+
+    case 'D':
+      if (n_fields >= 4)
+        replay_damage (replay, rw, fields, n_fields);
+      break;
+
+    case 'B':
+      if (n_fields >= 3 && parse_int (fields[2]) == replay->trace_screen)
+        replay_background (replay);
+      break;
+
+    default:
+      /* Frames describe the recorded session */
+      break;
+    }
+}
+
+/* Reads the records of a trace, calling func on each of them; returns
+   FALSE if the trace can't be read */
+static gboolean
+read_trace (const char  *path,
+            void       (*func) (char **fields, gint64 delay, gpointer data),
+            gpointer     data)
+{
+  char *contents;
+  char **lines;
+  GError *error = NULL;
+  int i;
+
+  if (!g_file_get_contents (path, &contents, NULL, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      char **fields;
+
+      if (lines[i][0] == '#' || lines[i][0] == '\0')
+        continue;
+
+      fields = g_strsplit (lines[i], " ", -1);
+      if (g_strv_length (fields) >= 2 && fields[1][0] != '\0')
+        func (fields, g_ascii_strtoll (fields[0], NULL, 10), data);
+      g_strfreev (fields);
+    }
+
+  g_strfreev (lines);
+  return TRUE;
+}
+
+typedef struct
+{
+  Replay *replay;
+  gint64 start;
+  gint64 target;
+  guint records;
+} ReplayClock;
+
+static void
+replay_func (char   **fields,
+             gint64   delay,
+             gpointer data)
+{
+  ReplayClock *clock = data;
+  gint64 now;
+
+  /* Keep to the recorded timing as a whole, however long the
+     requests themselves take */
+  clock->target += (gint64) (delay / speed);
+
+  XFlush (clock->replay->xdisplay);
+  now = g_get_monotonic_time () - clock->start;
+  if (clock->target > now)
+    g_usleep (clock->target - now);
+
+  replay_record (clock->replay, fields);
+  clock->records++;
+}
+
+static gboolean
+replay_trace (const char *display_name,
+              const char *path)
+{
+  Replay replay;
+  ReplayClock clock;
+  gboolean read;
+
+  replay.xdisplay = XOpenDisplay (display_name);
+  if (replay.xdisplay == NULL)
+    {
+      g_printerr ("Cannot open display %s\n", XDisplayName (display_name));
+      return FALSE;
+    }
+
+  replay.screen_number = DefaultScreen (replay.xdisplay);
+  replay.trace_screen = -1;
+  replay.root = RootWindow (replay.xdisplay, replay.screen_number);
+  replay.windows = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                          NULL, g_free);
+  replay.atom_opacity = XInternAtom (replay.xdisplay,
+                                     "_NET_WM_WINDOW_OPACITY", False);
+  replay.atom_root_pixmap = XInternAtom (replay.xdisplay,
+                                         "_XROOTPMAP_ID", False);
+  replay.atom_set_root = XInternAtom (replay.xdisplay,
+                                      "_XSETROOT_ID", False);
+  replay.background = None;
+  replay.background_count = 0;
+
+  clock.replay = &replay;
+  clock.start = g_get_monotonic_time ();
+  clock.target = 0;
+  clock.records = 0;
+
+  read = read_trace (path, replay_func, &clock);
+  XSync (replay.xdisplay, False);
+
+  if (read)
+    g_print ("Replayed %u records in %.2f s\n", clock.records,
+             (g_get_monotonic_time () - clock.start) / (double) G_USEC_PER_SEC);
+
+  g_hash_table_destroy (replay.windows);
+  XCloseDisplay (replay.xdisplay);
+
+  return read;
+}
+
+typedef struct
+{
+  GArray *paint_times;
+  guint64 pixels;
+  gint64 elapsed;
+} FrameReport;
+
+static void
+report_func (char   **fields,
+             gint64   delay,
+             gpointer data)
+{
+  FrameReport *report = data;
+  gint64 paint_time;
+
+  report->elapsed += delay;
+
+  if (fields[1][0] != 'F' || g_strv_length (fields) < 5)
+    return;
+
+  paint_time = g_ascii_strtoll (fields[3], NULL, 10);
+  g_array_append_val (report->paint_times, paint_time);
+  report->pixels += g_ascii_strtoull (fields[4], NULL, 10);
+
+  if (show_frames)
+    g_print ("frame %-6u at %10.3f ms: %6" G_GINT64_FORMAT " us, %s pixels,"
+             " %s painted, %s culled\n", report->paint_times->len,
+             report->elapsed / 1000.0, paint_time, fields[4],
+             fields[5] ? fields[5] : "?",
+             fields[5] && fields[6] ? fields[6] : "?");
+}
+
+static int
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static gint64
+percentile (GArray *sorted,
+            int     p)
+{
+  guint i = (sorted->len - 1) * p / 100;
+
+  return g_array_index (sorted, gint64, i);
+}
+
+static gboolean
+report_trace (const char *path)
+{
+  FrameReport report;
+  gint64 total = 0;
+  guint i;
+
+  report.paint_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+  report.pixels = 0;
+  report.elapsed = 0;
+
+  if (!read_trace (path, report_func, &report))
+    {
+      g_array_free (report.paint_times, TRUE);
+      return FALSE;
+    }
+
+  if (report.paint_times->len == 0)
+    {
+      g_print ("%s: no frames\n", path);
+      g_array_free (report.paint_times, TRUE);
+      return TRUE;
+    }
+
+  for (i = 0; i < report.paint_times->len; i++)
+    total += g_array_index (report.paint_times, gint64, i);
+  g_array_sort (report.paint_times, compare_times);
+
+  g_print ("%s: %u frames in %.2f s, %" G_GUINT64_FORMAT " pixels\n",
+           path, report.paint_times->len,
+           report.elapsed / (double) G_USEC_PER_SEC, report.pixels);
+  g_print ("paint time per frame (us): mean %.1f, median %" G_GINT64_FORMAT
+           ", 90%% %" G_GINT64_FORMAT ", 99%% %" G_GINT64_FORMAT
+           ", max %" G_GINT64_FORMAT "\n",
+           total / (double) report.paint_times->len,
+           percentile (report.paint_times, 50),
+           percentile (report.paint_times, 90),
+           percentile (report.paint_times, 99),
+           percentile (report.paint_times, 100));
+
+  g_array_free (report.paint_times, TRUE);
+  return TRUE;
+}
+
+/* The size of the first screen in the trace */
+static void
+screen_size_func (char   **fields,
+                  gint64   delay,
+                  gpointer data)
+{
+  int *size = data;
+
+  if (fields[1][0] == 'S' && size[0] == 0 && g_strv_length (fields) >= 5)
+    {
+      size[0] = parse_int (fields[3]);
+      size[1] = parse_int (fields[4]);
+    }
+}
+
+static gboolean
+wait_for_display (const char *display_name)
+{
+  int tries;
+
+  for (tries = 0; tries < 100; tries++)
+    {
+      Display *xdisplay = XOpenDisplay (display_name);
+
+      if (xdisplay != NULL)
+        {
+          XCloseDisplay (xdisplay);
+          return TRUE;
+        }
+
+      g_usleep (G_USEC_PER_SEC / 10);
+    }
+
+  return FALSE;
+}
+
+static gboolean
+wait_for_compositor (const char *display_name)
+{
+  Display *xdisplay = NULL;
+  gboolean running = FALSE;
+  int tries;
+
+  /* Xvfb and then metacity take a moment to start */
+  for (tries = 0; tries < 100 && !running; tries++)
+    {
+      if (xdisplay == NULL)
+        xdisplay = XOpenDisplay (display_name);
+
+      if (xdisplay != NULL)
+        {
+          char *name = g_strdup_printf ("_NET_WM_CM_S%d",
+                                        DefaultScreen (xdisplay));
+
+          running = XGetSelectionOwner (xdisplay,
+                                        XInternAtom (xdisplay, name,
+                                                     False)) != None;
+          g_free (name);
+        }
+
+      if (!running)
+        g_usleep (G_USEC_PER_SEC / 10);
+    }
+
+  if (xdisplay != NULL)
+    XCloseDisplay (xdisplay);
+
+  return running;
+}
+
+static void
+stop_child (GPid pid)
+{
+  kill (pid, SIGTERM);
+  waitpid (pid, NULL, 0);
+  g_spawn_close_pid (pid);
+}
+
+static gboolean
+replay_in_xvfb (const char *path)
+{
+  char *xvfb_argv[8];
+  char *metacity_argv[5];
+  char **envp;
+  char *display_name, *screen_spec, *results;
+  int size[2] = { 0, 0 };
+  GPid xvfb_pid, metacity_pid;
+  GError *error = NULL;
+  gboolean ok = FALSE;
+  int fd, n;
+
+  if (!read_trace (path, screen_size_func, size))
+    return FALSE;
+
+  if (size[0] <= 0 || size[1] <= 0)
+    {
+      size[0] = 1024;
+      size[1] = 768;
+    }
+
+  /* The first display nobody is using */
+  for (n = 90; n < 200; n++)
+    {
+      char *lock = g_strdup_printf ("/tmp/.X%d-lock", n);
+      gboolean used = g_file_test (lock, G_FILE_TEST_EXISTS);
+
+      g_free (lock);
+      if (!used)
+        break;
+    }
+
+  display_name = g_strdup_printf (":%d", n);
+  screen_spec = g_strdup_printf ("%dx%dx24", size[0], size[1]);
+
+  xvfb_argv[0] = "Xvfb";
+  xvfb_argv[1] = display_name;
+  xvfb_argv[2] = "-screen";
+  xvfb_argv[3] = "0";
+  xvfb_argv[4] = screen_spec;
+  xvfb_argv[5] = "-nolisten";
+  xvfb_argv[6] = "tcp";
+  xvfb_argv[7] = NULL;
+
+  if (!g_spawn_async (NULL, xvfb_argv, NULL,
+                      G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD |
+                      G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+                      NULL, NULL, &xvfb_pid, &error))
+    {
+      g_printerr ("Cannot start Xvfb: %s\n", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  fd = g_file_open_tmp ("metacity-replay-XXXXXX", &results, &error);
+  if (fd < 0)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      stop_child (xvfb_pid);
+      goto out;
+    }
+  close (fd);
+
+  envp = g_get_environ ();
+  envp = g_environ_setenv (envp, "DISPLAY", display_name, TRUE);
+  envp = g_environ_setenv (envp, "METACITY_COMPOSITOR_RECORD", results, TRUE);
+
+  metacity_argv[0] = metacity_path ? metacity_path : "metacity";
+  metacity_argv[1] = "--composite";
+  metacity_argv[2] = "--replace";
+  metacity_argv[3] = "--sm-disable";
+  metacity_argv[4] = NULL;
+
+  if (!wait_for_display (display_name) ||
+      !g_spawn_async (NULL, metacity_argv, envp,
+                      G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                      NULL, NULL, &metacity_pid, &error))
+    {
+      g_printerr ("Cannot start metacity: %s\n",
+                  error ? error->message : "Xvfb did not start");
+      g_clear_error (&error);
+      g_strfreev (envp);
+      stop_child (xvfb_pid);
+      unlink (results);
+      g_free (results);
+      goto out;
+    }
+  g_strfreev (envp);
+
+  if (wait_for_compositor (display_name))
+    {
+      ok = replay_trace (display_name, path);
+
+      /* Let the last frames be painted */
+      g_usleep (G_USEC_PER_SEC / 2);
+    }
+  else
+    g_printerr ("metacity did not start compositing\n");
+
+  stop_child (metacity_pid);
+  stop_child (xvfb_pid);
+
+  if (ok)
+    {
+      g_print ("Recorded session:\n");
+      report_trace (path);
+      g_print ("Replay:\n");
+      ok = report_trace (results);
+    }
+
+  unlink (results);
+  g_free (results);
+
+ out:
+  g_free (display_name);
+  g_free (screen_spec);
+  return ok;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  gboolean ok;
+
+  context = g_option_context_new ("TRACE");
+  g_option_context_set_summary (context,
+                                "Replays a trace recorded with "
+                                "METACITY_COMPOSITOR_RECORD");
+  g_option_context_add_main_entries (context, options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error) || argc != 2)
+    {
+      g_printerr ("%s\n", error ? error->message :
+                  "Usage: compositor-replay [OPTION...] TRACE");
+      return 1;
+    }
+  g_option_context_free (context);
+
+  if (speed <= 0.0)
+    speed = 1.0;
+
+  if (report_only)
+    ok = report_trace (argv[1]);
+  else if (use_xvfb)
+    ok = replay_in_xvfb (argv[1]);
+  else
+    ok = replay_trace (NULL, argv[1]);
+
+  return ok ? 0 : 1;
+}